@@ -0,0 +1,106 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Arena.h"
+#include <mutex>
+#include <new>
+#include <vector>
+using namespace std;
+
+namespace {
+	// The capacity is stored in front of the buffer. The header is one alignment unit, so the buffer stays aligned.
+	const size_t Header = Arena::Alignment;
+	// Released buffers beyond this number of bytes are freed. It holds a few frames of 100 megapixels.
+	const size_t MaxFreeBytes = (size_t)1 << 30;
+
+	inline size_t& Cap(const void* p) { return *(size_t*)((char*)p - Header); }
+
+	inline void Free(void* p) {
+		::operator delete((char*)p - Header, align_val_t(Arena::Alignment));
+	}
+
+	struct Pool {
+		mutex lock;
+		vector<void*> free;
+		size_t freeBytes = 0;  // The capacity of the buffers in free
+		size_t allocations = 0;
+		~Pool() {
+			for (void* p : free) { Free(p); }
+		}
+	};
+
+	Pool& GetPool() {
+		static Pool pool;
+		return pool;
+	}
+
+	thread_local size_t threadBytes = 0;
+}
+
+void* Arena::Acquire(size_t bytes) {
+	threadBytes += bytes;
+	Pool& pool = GetPool();
+	{
+		lock_guard<mutex> guard(pool.lock);
+		// Best fit: the smallest free buffer which is large enough. A buffer of more than twice the size is not
+		// used, e.g. a frame for a line, it is kept for the next request of its size.
+		int best = -1;
+		for (int n = 0; n < (int)pool.free.size(); n++) {
+			size_t c = Cap(pool.free[n]);
+			if ((c >= bytes) && (c / 2 <= bytes) && ((best < 0) || (c < Cap(pool.free[best])))) { best = n; }
+		}
+		if (best >= 0) {
+			void* p = pool.free[best];
+			pool.free[best] = pool.free.back();
+			pool.free.pop_back();
+			pool.freeBytes -= Cap(p);
+			return p;
+		}
+		pool.allocations++;
+	}
+	size_t cap = (bytes + Alignment - 1) / Alignment * Alignment;
+	char* b = (char*)::operator new(Header + cap, align_val_t(Alignment));
+	void* p = b + Header;
+	Cap(p) = cap;
+	return p;
+}
+
+void Arena::Release(void* p) {
+	if (p == nullptr) { return; }
+	Pool& pool = GetPool();
+	{
+		lock_guard<mutex> guard(pool.lock);
+		if (pool.freeBytes + Cap(p) <= MaxFreeBytes) {
+			pool.free.push_back(p);
+			pool.freeBytes += Cap(p);
+			return;
+		}
+	}
+	Free(p);
+}
+
+size_t Arena::Capacity(const void* p) {
+	return (p == nullptr) ? 0 : Cap(p);
+}
+
+size_t Arena::HeapAllocations() {
+	Pool& pool = GetPool();
+	lock_guard<mutex> guard(pool.lock);
+	return pool.allocations;
+}
+
+size_t Arena::ThreadBytes() {
+	return threadBytes;
+}
+
+void Arena::Trim() {
+	Pool& pool = GetPool();
+	lock_guard<mutex> guard(pool.lock);
+	for (void* p : pool.free) { Free(p); }
+	pool.free.clear();
+	pool.freeBytes = 0;
+}
@@ -0,0 +1,72 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstddef>
+
+/**
+<summary>
+    A pool of aligned buffers for the image data and the temporary frames and lines of the operations.
+    Released buffers are kept and handed out again by Acquire(), so processing a stream of images of the same size
+    does no heap allocations after the first image. The pool is shared by all threads, because the threads of 
+    Parallel::For() live only for one call.
+    A request takes the smallest free buffer with at most twice its size. The pool keeps at most 1 GB of released
+    buffers, the buffers beyond are freed.
+</summary>
+*/
+namespace Arena {
+    /**
+    <summary>All buffers are aligned to this number of bytes (one cache line).</summary>
+    */
+    const size_t Alignment = 64;
+
+    /**
+    <summary>Returns a buffer of at least bytes size. The content is undefined.</summary>
+    */
+    void* Acquire(size_t bytes);
+    /**
+    <summary>Returns the buffer p to the pool. nullptr is ignored.</summary>
+    */
+    void Release(void* p);
+    /**
+    <returns>The usable size of the buffer p in bytes.</returns>
+    */
+    size_t Capacity(const void* p);
+    /**
+    <returns>The number of heap allocations done by the pool so far.</returns>
+    */
+    size_t HeapAllocations();
+    /**
+    <returns>The number of bytes the calling thread has acquired so far, from the pool or the heap. The difference of
+    two calls is the memory an operation requested. Buffers acquired by the workers of Parallel::For() are counted
+    in the worker threads.</returns>
+    */
+    size_t ThreadBytes();
+    /**
+    <summary>Frees all buffers in the pool.</summary>
+    */
+    void Trim();
+
+    /**
+    <summary>A temporary array of n elements from the pool. It is returned to the pool at the end of the scope.
+    T must be a trivial type, no constructors are called.</summary>
+    */
+    template<class T>
+    class Scratch {
+    public:
+        explicit Scratch(size_t n) : p((T*)Acquire(n * sizeof(T))) {}
+        ~Scratch() { Release(p); }
+        Scratch(const Scratch&) = delete;
+        Scratch& operator=(const Scratch&) = delete;
+        operator T*() { return p; }
+        operator const T*() const { return p; }
+    private:
+        T* p;
+    };
+}
@@ -0,0 +1,42 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+
+/**
+<summary>The Bayer ordered dither matrix of size N=2^K, generated at compile time.
+The index of (x,y) is the bit-reversed interleaving of the bits of x^y and y. For K=2 this is
+     0  8  2 10
+    12  4 14  6
+     3 11  1  9
+    15  7 13  5
+The index b is scaled to the threshold t = (b+1)*256/(N*N)-1. For N=4 this is 16*b+15, for N=8 4*b+3. 
+Thresholds are at least 1, so BLACK stays BLACK.
+</summary>
+*/
+template<int K>
+struct BayerMatrix {
+    static_assert((K >= 1) && (K <= 6), "Bayer matrix size must be 2x2 ... 64x64");
+    static constexpr int N = 1 << K;
+    int32_t t[N * N];
+
+    constexpr BayerMatrix() : t() {
+        for (int y = 0; y < N; y++) {
+            for (int x = 0; x < N; x++) {
+                int b = 0;
+                for (int bit = 0; bit < K; bit++) {
+                    b = (b << 2) | ((((x ^ y) >> bit) & 1) << 1) | ((y >> bit) & 1);
+                }
+                int32_t v = ((b + 1) * 256) / (N * N) - 1;
+                t[y * N + x] = (v < 1) ? 1 : v;
+            }
+        }
+    }
+};
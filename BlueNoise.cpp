@@ -0,0 +1,119 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "BlueNoise.h"
+#include "math.h"
+#include <random>
+#include <vector>
+using namespace std;
+
+/**
+<summary>The void-and-cluster generator. The energy of a pixel is the sum of a toroidal gaussian (sigma 1.5) over
+all set pixels. The gaussian is scaled to integers, so the result does not depend on rounding of the compiler.
+</summary>
+*/
+class VoidAndCluster
+{
+public:
+	VoidAndCluster() : g(N), energy(N, 0), pattern(N, 0) {
+		const double sigma = 1.5;
+		for (int dy = 0; dy < S; dy++) {
+			int ty = (dy <= S / 2) ? dy : S - dy;
+			for (int dx = 0; dx < S; dx++) {
+				int tx = (dx <= S / 2) ? dx : S - dx;
+				g[dy * S + dx] = (int64_t)(exp(-(tx * tx + ty * ty) / (2.0 * sigma * sigma)) * 1.0e6 + 0.5);
+			}
+		}
+	}
+
+	vector<int32_t> Generate() {
+		vector<int> rank(N);
+		// Initial binary pattern with 10% random points
+		std::mt19937 rnd(47114713);
+		std::uniform_int_distribution<> unif(0, N - 1);
+		int ones = 0;
+		while (ones < N / 10) {
+			int p = unif(rnd);
+			if (pattern[p] == 0) {
+				Set(p, 1);
+				ones++;
+			}
+		}
+		// Moves the point of the tightest cluster into the largest void until the pattern is stable
+		for (int n = 0; n < N; n++) {
+			int c = Tightest();
+			Set(c, 0);
+			int v = Largest();
+			Set(v, 1);
+			if (v == c) { break; }
+		}
+		vector<uint8_t> proto = pattern;
+		vector<int64_t> protoEnergy = energy;
+		// Phase 1: ranks the points of the prototype by removing the tightest clusters
+		for (int r = ones - 1; r >= 0; r--) {
+			int c = Tightest();
+			Set(c, 0);
+			rank[c] = r;
+		}
+		// Phase 2 and 3: fills the largest voids. For a gaussian the tightest cluster of the 0s in phase 3
+		// is the same pixel as the largest void of the 1s.
+		pattern = proto;
+		energy = protoEnergy;
+		for (int r = ones; r < N; r++) {
+			int v = Largest();
+			Set(v, 1);
+			rank[v] = r;
+		}
+		vector<int32_t> mask(N);
+		for (int n = 0; n < N; n++) {
+			mask[n] = 1 + (int32_t)((rank[n] * 255LL) / N);
+		}
+		return mask;
+	}
+
+private:
+	static const int S = BlueNoiseSize;
+	static const int N = BlueNoiseSize * BlueNoiseSize;
+	vector<int64_t> g;
+	vector<int64_t> energy;
+	vector<uint8_t> pattern;
+
+	void Set(int p, uint8_t v) {
+		pattern[p] = v;
+		int py = p / S;
+		int px = p % S;
+		int64_t sign = (v != 0) ? 1 : -1;
+		for (int y = 0; y < S; y++) {
+			const int64_t* gy = g.data() + ((y - py) & (S - 1)) * S;
+			int64_t* e = energy.data() + y * S;
+			for (int x = 0; x < S; x++) {
+				e[x] += sign * gy[(x - px) & (S - 1)];
+			}
+		}
+	}
+
+	int Tightest() {
+		int best = -1;
+		for (int n = 0; n < N; n++) {
+			if ((pattern[n] != 0) && ((best < 0) || (energy[n] > energy[best]))) { best = n; }
+		}
+		return best;
+	}
+
+	int Largest() {
+		int best = -1;
+		for (int n = 0; n < N; n++) {
+			if ((pattern[n] == 0) && ((best < 0) || (energy[n] < energy[best]))) { best = n; }
+		}
+		return best;
+	}
+};
+
+const int32_t* BlueNoiseMask() {
+	static const vector<int32_t> mask = VoidAndCluster().Generate();
+	return mask.data();
+}
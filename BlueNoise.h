@@ -0,0 +1,26 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+
+/**
+<summary>Width and height of the blue noise threshold tile. Must be a power of 2.</summary>
+*/
+const int BlueNoiseSize = 64;
+
+/**
+<summary>Returns the blue noise threshold mask for MLGray::BlueNoise(). The mask has BlueNoiseSize*BlueNoiseSize
+thresholds in [1,255] and is stored line-wise. It tiles seamlessly. 
+The mask is generated on the first call with the void-and-cluster method of R. Ulichney:
+"The void-and-cluster method for dither array generation" (1993). The generation is deterministic and takes
+a few milliseconds. It is done only once per process.
+</summary>
+*/
+const int32_t* BlueNoiseMask();
@@ -0,0 +1,120 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "BlurScore.h"
+#include "Parallel.h"
+#include "Arena.h"
+#include "math.h"
+using namespace std;
+
+namespace {
+	const int R = 3;  // radius of the filter
+	const int Lanes = 8;  // independent accumulators of the distance, they break the dependency chain of the sum
+	const float Scale = 1.0f / 4096.0f;
+
+	const float G[2 * R + 1] = { 1.0f, 6.0f, 15.0f, 20.0f, 15.0f, 6.0f, 1.0f };
+
+	inline float GaussBorder(const int32_t* s, int width, int x) {
+		float v = 0.0f;
+		for (int k = -R; k <= R; k++) {
+			int px = x + k;
+			px = (px < 0) ? 0 : (px < width) ? px : width - 1;
+			v += G[R + k] * (float)s[px];
+		}
+		return v;
+	}
+
+	/**
+	<summary>The horizontal pass of one line.</summary>
+	*/
+	void GaussRow(const int32_t* s, int width, float* o) {
+		int l = (R < width) ? R : width;
+		int h = (width - R > l) ? width - R : l;
+		for (int x = 0; x < l; x++) { o[x] = GaussBorder(s, width, x); }
+		for (int x = l; x < h; x++) {
+			o[x] = (float)(s[x - 3] + s[x + 3]) + 6.0f * (float)(s[x - 2] + s[x + 2])
+				+ 15.0f * (float)(s[x - 1] + s[x + 1]) + 20.0f * (float)s[x];
+		}
+		for (int x = h; x < width; x++) { o[x] = GaussBorder(s, width, x); }
+	}
+
+	/**
+	<summary>The vertical pass of the 7 horizontally filtered lines w at position x.</summary>
+	*/
+	inline float GaussCol(const float* const* w, int x) {
+		return ((w[0][x] + w[6][x]) + 6.0f * (w[1][x] + w[5][x]) + 15.0f * (w[2][x] + w[4][x]) + 20.0f * w[3][x]) * Scale;
+	}
+
+	/**
+	<summary>Filters the lines [from,to) of src. For each line sink(y,w) is called with the 7 horizontally
+	filtered lines y-3...y+3. Lines outside the image are replaced by the nearest border line.</summary>
+	*/
+	template<class Sink>
+	void Stream(const int32_t* src, int width, int height, int stride, int from, int to, Sink sink) {
+		Arena::Scratch<float> ring((size_t)(2 * R + 1) * width);
+		auto row = [&](int y) { return (float*)ring + (size_t)(y % (2 * R + 1)) * width; };
+		const float* w[2 * R + 1];
+		int next = (from - R > 0) ? from - R : 0;
+		for (int y = from; y < to; y++) {
+			int last = (y + R < height) ? y + R : height - 1;
+			for (; next <= last; next++) {
+				GaussRow(src + (size_t)next * stride, width, row(next));
+			}
+			for (int k = -R; k <= R; k++) {
+				int py = y + k;
+				py = (py < 0) ? 0 : (py < height) ? py : height - 1;
+				w[R + k] = row(py);
+			}
+			sink(y, w);
+		}
+	}
+
+	// d is a multiple of 1/4096 below 256 and exact in float. Its square needs 40 bits, so the lanes sum in double.
+	template<int Norm>
+	double LineDistance(const float* const* w, const float* ref, int width) {
+		double acc[Lanes] = {};
+		int x = 0;
+		for (; x + Lanes <= width; x += Lanes) {
+			for (int l = 0; l < Lanes; l++) {
+				double d = GaussCol(w, x + l) - ref[x + l];
+				acc[l] += (Norm == BlurScore::L1) ? fabs(d) : d * d;
+			}
+		}
+		for (int l = 0; x < width; x++, l++) {
+			double d = GaussCol(w, x) - ref[x];
+			acc[l] += (Norm == BlurScore::L1) ? fabs(d) : d * d;
+		}
+		double sum = 0.0;
+		for (int l = 0; l < Lanes; l++) { sum += acc[l]; }
+		return sum;
+	}
+}
+
+void BlurScore::Gauss77(const int32_t* src, int width, int height, int stride, float* ref) {
+	if ((height <= 0) || (width <= 0)) { return; }
+	Parallel::For(0, height, [&](int from, int to) {
+		Stream(src, width, height, stride, from, to, [&](int y, const float* const* w) {
+			float* o = ref + (size_t)y * width;
+			for (int x = 0; x < width; x++) { o[x] = GaussCol(w, x); }
+		});
+	});
+}
+
+double BlurScore::Distance(const int32_t* src, int width, int height, int stride, const float* ref, int norm) {
+	if ((height <= 0) || (width <= 0)) { return 0.0; }
+	// The lines are summed in a fixed order, independent of the blocks of the threads
+	Arena::Scratch<double> lineDist(height);
+	Parallel::For(0, height, [&](int from, int to) {
+		Stream(src, width, height, stride, from, to, [&](int y, const float* const* w) {
+			const float* r = ref + (size_t)y * width;
+			lineDist[y] = (norm == L2) ? LineDistance<L2>(w, r, width) : LineDistance<L1>(w, r, width);
+		});
+	});
+	double sum = 0.0;
+	for (int y = 0; y < height; y++) { sum += lineDist[y]; }
+	return sum;
+}
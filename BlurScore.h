@@ -0,0 +1,46 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+
+/**
+<summary>
+    The quality metric of the threshold search in MLGray::OptHalftone(). The metric is the distance between the
+    separable 7x7 Gauss filter (1 6 15 20 15 6 1) of the original image and of the halftone. The border pixels are
+    replicated.
+    The filter is calculated in float. All intermediate values are integers below 2^24 and the final division is by
+    4096, so the filtered values are exact and the same as with double. The distances are summed in double: a
+    squared difference needs 40 bits, so the distance of a line is exact up to a width of 65536 pixels.
+    Distance() fuses the filter and the distance. It streams over the lines of the halftone and keeps only a ring of
+    7 filtered lines per thread. The filtered halftone is never stored.
+</summary>
+*/
+namespace BlurScore {
+    enum Norm { L1 = 1, L2 = 2 };
+
+    /**
+    <summary>The 7x7 Gauss filter of src.</summary>
+    <param name="src">The image, width*height pixels</param>
+    <param name="stride">The distance of two lines of src</param>
+    <param name="ref">The filtered image. It must have at least width*height elements, stored without padding</param>
+    */
+    void Gauss77(const int32_t* src, int width, int height, int stride, float* ref);
+
+    /**
+    <summary>The distance between the 7x7 Gauss filter of src and ref in a single pass.
+    The result does not depend on the number of threads.</summary>
+    <param name="src">The halftone, width*height pixels</param>
+    <param name="stride">The distance of two lines of src</param>
+    <param name="ref">The filtered original image. See Gauss77()</param>
+    <param name="norm">L1 sums the absolute differences, L2 the squared differences</param>
+    <returns>The sum of the distances of all pixels</returns>
+    */
+    double Distance(const int32_t* src, int width, int height, int stride, const float* ref, int norm = L1);
+}
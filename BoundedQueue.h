@@ -0,0 +1,75 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+<summary>
+    A first-in first-out queue between the threads of a pipeline. Push() blocks while the queue is full, so a fast
+    producer can not run ahead of a slow consumer by more than capacity items. Close() ends the stream.
+</summary>
+*/
+template<class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity((capacity > 0) ? capacity : 1) {}
+
+    /**
+    <summary>Appends item. Blocks while the queue is full.</summary>
+    <returns>false if the queue is closed, then item is dropped.</returns>
+    */
+    bool Push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        notFull.wait(guard, [this] { return closed || (items.size() < capacity); });
+        if (closed) { return false; }
+        items.push_back(std::move(item));
+        guard.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+    <summary>Removes the first item. Blocks while the queue is empty and open.</summary>
+    <returns>false if the queue is closed and empty.</returns>
+    */
+    bool Pop(T& item) {
+        std::unique_lock<std::mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty()) { return false; }
+        item = std::move(items.front());
+        items.pop_front();
+        guard.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    /**
+    <summary>Ends the stream. Pop() returns the remaining items, Push() fails.</summary>
+    */
+    void Close() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    std::deque<T> items;
+    std::mutex lock;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    size_t capacity;
+    bool closed = false;
+};
@@ -0,0 +1,176 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Command.h"
+#include "Trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+namespace {
+	typedef Command::Op Op;
+	const int C = Command::CONVERTER;
+	const int P = Command::PREPROCESS;
+	const int H = Command::HALFTONING;
+	const int S = Command::POSTPROCESS;
+
+	// The optimized halftones take from, to, proxy, validate and l2. E.g. OptFloydSteinberg:64:192:4:1
+	inline void OptParams(const double* p, int n, int* opt) {
+		for (int i = 0; i < n; i++) { opt[i] = (int)p[i]; }
+	}
+
+	// The order matters, the first entry whose name is a prefix of the command is taken
+	const Op Registry[] = {
+		{ C, "ColorChannel", 0, 1, [](MLGray& img, const MLSource& f, const double* p, int n) {
+			return (n >= 1) ? img.ColorChannel(f, (int)p[0]) : img.ColorChannel(f); } },
+		{ C, "GIMP", 0, 1, [](MLGray& img, const MLSource& f, const double* p, int n) {
+			return (n >= 1) ? img.SaturateGIMP(f, p[0]) : img.SaturateGIMP(f); } },
+		{ C, "Qt", 0, 1, [](MLGray& img, const MLSource& f, const double* p, int n) {
+			return (n >= 1) ? img.SaturateQt(f, p[0]) : img.SaturateQt(f); } },
+		{ C, "Helmholtz", 0, 1, [](MLGray& img, const MLSource& f, const double* p, int n) {
+			return (n >= 1) ? img.Helmholtz(f, p[0]) : img.Helmholtz(f); } },
+		{ C, "Desaturate", 0, 0, [](MLGray& img, const MLSource& f, const double*, int) { return img.Desaturate(f); } },
+		{ C, "Value", 0, 0, [](MLGray& img, const MLSource& f, const double*, int) { return img.Value(f); } },
+		{ C, "Saturate", 3, 3, [](MLGray& img, const MLSource& f, const double* p, int) {
+			return img.Saturate(f, p[0], p[1], p[2]); } },
+
+		{ P, "Gauss5", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Gauss55Filter(); } },
+		{ P, "Gauss7", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Gauss77Filter(); } },
+		{ P, "Laplace", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.LaplaceSharpen(p[0]) : img.LaplaceSharpen(); } },
+		{ P, "Edge", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.KnuthEdge(p[0]) : img.KnuthEdge(); } },
+		{ P, "MedLaplace", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Med5Laplace(p[0]) : img.Med5Laplace(); } },
+		{ P, "Logistic", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Logistic(p[0]) : img.Logistic(); } },
+		{ P, "Rescale", 0, 2, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 2) ? img.Rescale(p[0], p[1]) : img.Rescale(); } },
+		{ P, "Median", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.MedianFilter9(); } },
+
+		{ H, "FloydSteinberg", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.FloydSteinberg((int32_t)p[0]) : img.FloydSteinberg(); } },
+		{ H, "Jarvis", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Jarvis((int32_t)p[0]) : img.Jarvis(); } },
+		{ H, "Stucki", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Stucki((int32_t)p[0]) : img.Stucki(); } },
+		{ H, "Burkes", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Burkes((int32_t)p[0]) : img.Burkes(); } },
+		{ H, "SierraLite", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.SierraLite((int32_t)p[0]) : img.SierraLite(); } },
+		{ H, "Atkinson", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Atkinson((int32_t)p[0]) : img.Atkinson(); } },
+		{ H, "Ostromoukhov", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Ostromoukhov((int32_t)p[0]) : img.Ostromoukhov(); } },
+		{ H, "OptOstromoukhov", 0, 5, [](MLGray& img, const MLSource&, const double* p, int n) {
+			int opt[5] = { 64, 192, 1, 0, 0 };
+			OptParams(p, n, opt);
+			return img.OptOstromoukhov(opt[0], opt[1], opt[2], opt[3] != 0, opt[4] != 0) >= 0; } },
+		{ H, "OptFloydSteinberg", 0, 5, [](MLGray& img, const MLSource&, const double* p, int n) {
+			int opt[5] = { 64, 192, 1, 0, 0 };
+			OptParams(p, n, opt);
+			return img.OptFloydSteinberg(opt[0], opt[1], opt[2], opt[3] != 0, opt[4] != 0) >= 0; } },
+		{ H, "OptJarvis", 0, 5, [](MLGray& img, const MLSource&, const double* p, int n) {
+			int opt[5] = { 64, 192, 1, 0, 0 };
+			OptParams(p, n, opt);
+			return img.OptJarvis(opt[0], opt[1], opt[2], opt[3] != 0, opt[4] != 0) >= 0; } },
+		{ H, "OptStucki", 0, 5, [](MLGray& img, const MLSource&, const double* p, int n) {
+			int opt[5] = { 64, 192, 1, 0, 0 };
+			OptParams(p, n, opt);
+			return img.OptStucki(opt[0], opt[1], opt[2], opt[3] != 0, opt[4] != 0) >= 0; } },
+		{ H, "Bayer44", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Bayer44(); } },
+		{ H, "Bayer88", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Bayer88(); } },
+		{ H, "BayerRnd88", 0, 2, [](MLGray& img, const MLSource&, const double* p, int n) {
+			if (n >= 2) { return img.BayerRnd88((int32_t)p[0], (uint32_t)p[1]); }
+			return (n >= 1) ? img.BayerRnd88((int32_t)p[0]) : img.BayerRnd88(); } },
+		{ H, "Bayer", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Bayer((int)p[0]) : img.Bayer(); } },
+		{ H, "BlueNoise", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.BlueNoise(); } },
+		{ H, "Random", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Random((uint32_t)p[0]) : img.Random(); } },
+		{ H, "Threshold", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.Threshold((int32_t)p[0]) : img.Threshold(); } },
+
+		{ S, "SaltPepper", 0, 1, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 1) ? img.SaltPepper((int32_t)p[0]) : img.SaltPepper(); } },
+		{ S, "Gauss5", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Gauss55Filter(); } },
+		{ S, "Gauss7", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Gauss77Filter(); } },
+		{ S, "Majority", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Majority(); } },
+		{ S, "Invert", 0, 0, [](MLGray& img, const MLSource&, const double*, int) { return img.Invert(); } },
+		{ S, "GameOfLife", 0, 2, [](MLGray& img, const MLSource&, const double* p, int n) {
+			return (n >= 2) ? img.GameOfLife(p[0] != 0.0, (int)p[1]) : img.GameOfLife(); } },
+	};
+
+	const char* ColumnName[] = { "Grayconverter", "Preprocessing", "Halftoning", "Postprocessing" };
+}
+
+bool Command::Parse(int column, const string& text, string& error) {
+	op = nullptr;
+	n = 0;
+	string t;
+	for (char c : text) {
+		if ((c != ' ') && (c != '\r')) { t += c; }
+	}
+	if (t.empty()) {
+		if (column != CONVERTER) { return true; }
+		error = "Missing Grayconverter";
+		return false;
+	}
+	size_t colon = t.find(':');
+	string name = t.substr(0, colon);
+	for (const Op& r : Registry) {
+		if ((r.column == column) && (name.compare(0, strlen(r.name), r.name) == 0)) {
+			op = &r;
+			break;
+		}
+	}
+	if (op == nullptr) {
+		error = string("Unknown ") + ColumnName[column] + " operation " + t;
+		return false;
+	}
+	// The parameters are parsed up to the first one which is not a number
+	const char* s = (colon == string::npos) ? "" : t.c_str() + colon + 1;
+	while ((n < op->maxParams) && (*s != 0)) {
+		char* end;
+		double v = strtod(s, &end);
+		if (end == s) { break; }
+		p[n++] = v;
+		s = strchr(end, ':');
+		if (s == nullptr) { break; }
+		s++;
+	}
+	if (n < op->minParams) {
+		error = string(op->name) + " needs " + to_string(op->minParams) + " parameters: " + t;
+		op = nullptr;
+		return false;
+	}
+	return true;
+}
+
+const Command::Op* Command::Operations(int& count) {
+	count = (int)(sizeof(Registry) / sizeof(Registry[0]));
+	return Registry;
+}
+
+bool Command::Run(MLGray& img, const MLSource& src) const {
+	if (op == nullptr) { return true; }
+	Trace::Scope s(op->name);
+	if (Trace::Enabled()) { s.Detail(Key()); }
+	return op->run(img, src, p, n);
+}
+
+string Command::Key() const {
+	if (op == nullptr) { return ""; }
+	string key = op->name;
+	char v[32];
+	for (int i = 0; i < n; i++) {
+		snprintf(v, sizeof(v), ":%.17g", p[i]);
+		key += v;
+	}
+	return key;
+}
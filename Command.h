@@ -0,0 +1,81 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include "MLGray.h"
+#include <string>
+
+/**
+<summary>
+    A parsed column of the command file, e.g. OptFloydSteinberg:64:192:4. The text is parsed once into an entry of a
+    static registry of the operations and its numeric parameters, so running a command does no string processing.
+    The name of the operation is matched as prefix in the order of the registry, e.g. Bayer88Rnd is Bayer88.
+    Parameters which are missing or can not be parsed take the default values of the MLGray method.
+</summary>
+*/
+class Command {
+public:
+    /**
+    <summary>The columns of the command file which contain operations.</summary>
+    */
+    enum Column { CONVERTER, PREPROCESS, HALFTONING, POSTPROCESS };
+    static const int MaxParams = 5;
+
+    /**
+    <summary>Parses the text of a column. Blanks are ignored. An empty text is a valid command which does nothing,
+    except for the CONVERTER.</summary>
+    <param name="column">The Column.</param>
+    <param name="text">The text of the column.</param>
+    <param name="error">Receives the error message.</param>
+    <returns>true if the operation is known and has enough parameters.</returns>
+    */
+    bool Parse(int column, const std::string& text, std::string& error);
+    /**
+    <summary>Performs the command on the image.</summary>
+    <param name="img">The image.</param>
+    <param name="src">The input image of the CONVERTER. Not used by the other columns.</param>
+    <returns>The result of the operation. true for an empty command.</returns>
+    */
+    bool Run(MLGray& img, const MLSource& src) const;
+    /**
+    <returns>The normalized command: the name of the operation and the parsed parameters.
+    Two commands with the same key give the same result.</returns>
+    */
+    std::string Key() const;
+    /**
+    <returns>true if the command does nothing.</returns>
+    */
+    bool Empty() const { return op == nullptr; }
+    /**
+    <returns>The name of the operation without the parameters. Empty if the command does nothing.</returns>
+    */
+    std::string Name() const { return (op == nullptr) ? "" : op->name; }
+
+    /**
+    <summary>An entry of the registry.</summary>
+    */
+    struct Op {
+        int column;
+        const char* name;
+        int minParams;  // Commands with fewer parameters are rejected
+        int maxParams;
+        bool (*run)(MLGray& img, const MLSource& src, const double* p, int n);
+    };
+
+    /**
+    <summary>The registry in matching order, e.g. to enumerate the operations in a benchmark.</summary>
+    <param name="count">Receives the number of entries.</param>
+    */
+    static const Op* Operations(int& count);
+
+private:
+    const Op* op = nullptr;
+    double p[MaxParams] = {};
+    int n = 0;  // number of parsed parameters
+};
@@ -0,0 +1,125 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "CommandFile.h"
+#include "ResultCache.h"
+#include "Synthetic.h"
+#include "Trace.h"
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+using namespace std;
+
+int ParamN(string cmd, int* v, int maxN) {
+	int p = cmd.find(':');
+	if (p < 0) { return 0; }
+	istringstream s(cmd.substr(p + 1));
+	string ps;
+	int n = 0;
+	try {
+		for (; (n < maxN) && (getline(s, ps, ':')); n++) {
+			v[n] = stoi(ps);
+		}
+	}
+	catch (const exception&) {
+		// v[n] is not a valid int. The callers check the count.
+	}
+	return n;
+}
+
+string OutputFile(string fName) {
+	return "./result/" + fName + ".jpg";
+}
+
+void Diagnostic(int lineNr, const string& text) {
+	static mutex lock;
+	lock_guard<mutex> guard(lock);
+	cerr << "Line " << lineNr << ": " << text << endl;
+}
+
+bool SaveImage(string fName,MLGray &img) {
+	if (fName.empty()) { return false; }
+	return img.SaveImage(OutputFile(fName));
+}
+
+bool ParseRow(const string& line, int lineNr, Row& row, bool report) {
+	row.lineNr = lineNr;
+	row.line = line;
+	if ((!row.line.empty()) && (row.line.back() == '\r')) { row.line.pop_back(); }
+	istringstream s(row.line);
+	string field[8];
+	for (int n = 0; (n <= 7) && (getline(s, field[n], ',')); n++) {}
+	bool ok = true;
+	auto fail = [&ok, lineNr, report](const string& error) {
+		if (report) { Diagnostic(lineNr, error); }
+		ok = false;
+	};
+	if (field[0].empty()) { fail("Missing input FileName"); }
+	row.input = Synthetic::IsSpec(field[0]) ? field[0] : "./image/" + field[0] + ".jpg";
+	if (Synthetic::IsSpec(field[0]) && !Synthetic::Valid(field[0])) { fail("Invalid synthetic image " + field[0]); }
+	string error;
+	for (int c = Command::CONVERTER; c <= Command::POSTPROCESS; c++) {
+		if (!row.cmd[c].Parse(c, field[c + 1], error)) { fail(error); }
+	}
+	row.output = field[5];
+	for (int n = 6; n <= 7; n++) {
+		if (field[n].empty()) { continue; }
+		if (field[n].compare(0, 7, "Preview") == 0) {
+			int p = 0;
+			ParamN(field[n], &p, 1);
+			if ((p != 1) && (p != 2) && (p != 4) && (p != 8)) { fail("Invalid preview scale " + field[n]); }
+			row.preview = p;
+			continue;
+		}
+		row.region = true;
+		if (ParamN(field[n], row.roi, 4) != 4) { fail("Invalid region " + field[n]); }
+	}
+	if (row.region && (row.preview > 1)) {  // The region is given in the coordinates of the full size image
+		for (int i = 0; i < 2; i++) {
+			int from = row.roi[i] / row.preview;
+			int to = (row.roi[i] + row.roi[i + 2] + row.preview - 1) / row.preview;
+			row.roi[i] = from;
+			row.roi[i + 2] = to - from;
+		}
+	}
+	return ok;
+}
+
+bool RunStage(int stage, const Row& row, MLGray& img, bool lazy) {
+	static const char* traceName[SAVE + 1] = { "Read", "Preprocess", "Halftoning", "Postprocess", "Save" };
+	Trace::Scope s(traceName[stage]);
+	if (Trace::Enabled()) { s.Detail("line " + to_string(row.lineNr)); }
+	if (stage == READ) {
+		MLSource src(row.input);
+		src.SetScale(row.preview);
+		if (!row.cmd[READ].Run(img, src)) {
+			Diagnostic(row.lineNr, "Can not convert " + row.input + " with " + row.cmd[READ].Key());
+			return false;
+		}
+		return true;
+	}
+	if (stage == SAVE) {
+		ResultCache::Invalidate(OutputFile(row.output));
+		if (!SaveImage(row.output, img)) {
+			Diagnostic(row.lineNr, "Can not write " + OutputFile(row.output));
+			return false;
+		}
+		ResultCache::Store(OutputFile(row.output), row.key);
+		return true;
+	}
+	if (row.cmd[stage].Empty()) { return true; }
+	if (!row.region) {
+		row.cmd[stage].Run(img, row.input);
+		return true;
+	}
+	MLGray view = img.View(row.roi[0], row.roi[1], row.roi[2], row.roi[3]);
+	if (lazy) { view.SetLazy(); }
+	row.cmd[stage].Run(view, row.input);
+	view.Materialize();
+	return true;
+}
@@ -0,0 +1,103 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include "Command.h"
+#include "MLGray.h"
+#include <string>
+
+/**
+<summary>
+    The lines of the command file: input,converter,preprocess,halftone,postprocess,output[,Roi:x:y:w:h][,Preview:n].
+    A line is parsed into a Row and performed stage by stage with RunStage(). MonaLena runs the lines, MonaLenaVerify
+    checks the images of their stages, so both see the same columns, defaults and errors.
+</summary>
+*/
+
+/**
+<summary>The stages of a command line. The stages up to POSTPROCESS compute the image.</summary>
+*/
+enum Stage { READ, PREPROCESS, HALFTONING, POSTPROCESS, SAVE };
+
+/**
+<summary>A parsed line of the command file.</summary>
+*/
+struct Row {
+    int lineNr = 0;
+    std::string line;
+    std::string input;  // The input image file
+    Command cmd[POSTPROCESS + 1];  // The commands of the stages READ..POSTPROCESS
+    bool region = false;  // true if the line has a region column
+    int roi[4] = {};  // x, y, w, h of the region in the (scaled) image
+    int preview = 1;  // The input is decoded at 1/preview of its size, see MLSource::SetScale()
+    std::string output;  // The name of the output image
+    std::string key;  // The ResultCache key. Empty if the cache is not used.
+
+    /**
+    <returns>The normalized key of the stage. Lines whose stages up to stage have equal keys compute the same image.
+    </returns>
+    */
+    std::string StageKey(int stage) const {
+        if (stage == READ) { return input + "," + cmd[READ].Key() + ((preview > 1) ? ",Preview:" + std::to_string(preview) : ""); }
+        if (stage == PREPROCESS) {
+            std::string r = (region) ? std::to_string(roi[0]) + ":" + std::to_string(roi[1]) + ":" + std::to_string(roi[2]) + ":" + std::to_string(roi[3]) : "";
+            return r + "," + cmd[PREPROCESS].Key();
+        }
+        return cmd[stage].Key();
+    }
+};
+
+/**
+<summary> Parses up to maxN integer parameters of a command. E.g. OptFloydSteinberg:64:192:4
+Parameters which are missing keep their value.</summary>
+<param name="cmd">The command.</param>
+<param name="v">The parsed parameter values.</param>
+<param name="maxN">The maximal number of parameters.</param>
+<returns>The number of parsed parameters. The parsing stops at the first parameter which is not a number or out of
+range.</returns>
+*/
+int ParamN(std::string cmd, int* v, int maxN);
+
+/**
+<returns>The file name of the output image fName. E.g. ./result/Trini_GIMP_FloydSteinberg.jpg</returns>
+*/
+std::string OutputFile(std::string fName);
+
+/**
+<summary>Reports a problem of a command line on cerr. The server writes its completion records to cout from several
+threads, so the messages are kept apart from them and written one at a time.</summary>
+*/
+void Diagnostic(int lineNr, const std::string& text);
+
+/**
+<summary> Saves the image as *.JPG in RGB format in a file.</summary>
+<param name="fName">The fName of the image. Without the extension ".JPG". The file will be stored
+in the subdirectory ./result Example: Trini_GIMP_FloydSteinberg.</param>
+<returns> true if file can be saved. Otherwise false</returns>
+*/
+bool SaveImage(std::string fName, MLGray& img);
+
+/**
+<summary>Parses a line of the command file. The input file is ./image/name.jpg, unless it is a synthetic spec.
+</summary>
+<param name="report">true if the errors are reported with the line number, see Diagnostic().</param>
+<returns>false if the line has errors.</returns>
+*/
+bool ParseRow(const std::string& line, int lineNr, Row& row, bool report = true);
+
+/**
+<summary>Performs a stage of a command line. With a region (7th column) the preprocessing, halftoning and
+postprocessing work on a view of the region. The SAVE stage writes the output and its ResultCache key.</summary>
+<param name="stage">The Stage.</param>
+<param name="row">The command line.</param>
+<param name="img">The image. Keeps its buffers between the calls.</param>
+<param name="lazy">true if a region of the image is processed in lazy mode.</param>
+<returns>false if the image can not be read and converted or the output can not be written. Otherwise true</returns>
+*/
+bool RunStage(int stage, const Row& row, MLGray& img, bool lazy);
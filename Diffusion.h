@@ -0,0 +1,155 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+#include <utility>
+
+/**
+<summary>
+    The diffusion kernels of the error diffusion engine MLGray::ErrorDiffusion(). A kernel is a compile-time
+    description of the diffusion matrix:
+    Rows     number of lines the error is diffused to, including the current line.
+    Left     extent of the matrix left of the current pixel.
+    Right    extent of the matrix right of the current pixel.
+    Divisor  the weights are divided by this value.
+    EdgeDown if not 0, replaces the weight straight down at the left and right border of the image. This compensates
+             the error which can not be diffused outside the image. 0 drops the weights outside the image.
+    W        the weights. W[0][Left] is the current pixel. It and all weights left of it in line 0 must be 0.
+    For the ghost row above the image the error of a pixel is diffused with W[0][Left+1] to the right and with
+    W[1][Left] straight down.
+</summary>
+*/
+struct FloydSteinbergKernel {
+    static constexpr int Rows = 2;
+    static constexpr int Left = 1;
+    static constexpr int Right = 1;
+    static constexpr int Divisor = 16;
+    static constexpr int EdgeDown = 8;
+    static constexpr int W[Rows][Left + 1 + Right] = {
+        { 0, 0, 7 },
+        { 3, 5, 1 } };
+};
+
+struct JarvisKernel {
+    static constexpr int Rows = 3;
+    static constexpr int Left = 2;
+    static constexpr int Right = 2;
+    static constexpr int Divisor = 48;
+    static constexpr int EdgeDown = 0;
+    static constexpr int W[Rows][Left + 1 + Right] = {
+        { 0, 0, 0, 7, 5 },
+        { 3, 5, 7, 5, 3 },
+        { 1, 3, 5, 3, 1 } };
+};
+
+struct StuckiKernel {
+    static constexpr int Rows = 3;
+    static constexpr int Left = 2;
+    static constexpr int Right = 2;
+    static constexpr int Divisor = 42;
+    static constexpr int EdgeDown = 0;
+    static constexpr int W[Rows][Left + 1 + Right] = {
+        { 0, 0, 0, 8, 4 },
+        { 2, 4, 8, 4, 2 },
+        { 1, 2, 4, 2, 1 } };
+};
+
+struct BurkesKernel {
+    static constexpr int Rows = 2;
+    static constexpr int Left = 2;
+    static constexpr int Right = 2;
+    static constexpr int Divisor = 32;
+    static constexpr int EdgeDown = 0;
+    static constexpr int W[Rows][Left + 1 + Right] = {
+        { 0, 0, 0, 8, 4 },
+        { 2, 4, 8, 4, 2 } };
+};
+
+struct SierraLiteKernel {
+    static constexpr int Rows = 2;
+    static constexpr int Left = 1;
+    static constexpr int Right = 1;
+    static constexpr int Divisor = 4;
+    static constexpr int EdgeDown = 0;
+    static constexpr int W[Rows][Left + 1 + Right] = {
+        { 0, 0, 2 },
+        { 1, 1, 0 } };
+};
+
+struct AtkinsonKernel {  // Diffuses only 6/8 of the error
+    static constexpr int Rows = 3;
+    static constexpr int Left = 1;
+    static constexpr int Right = 2;
+    static constexpr int Divisor = 8;
+    static constexpr int EdgeDown = 0;
+    static constexpr int W[Rows][Left + 1 + Right] = {
+        { 0, 0, 1, 1 },
+        { 1, 1, 1, 0 },
+        { 0, 1, 0, 0 } };
+};
+
+namespace Diffusion {
+    /**
+    <summary>Diffuses the error of the pixel p to the tap (R,C) of the kernel. No code is generated for 0 weights.</summary>
+    */
+    template<class K, int R, int C>
+    inline void Tap(int32_t* p, int32_t err, int stride) {
+        if constexpr ((K::W[R][C] != 0) && ((R > 0) || (C > K::Left))) {
+            constexpr double f = (double)K::W[R][C] / K::Divisor;
+            p[R * stride + C - K::Left] += (int32_t)(err * f + 0.5);
+        }
+    }
+
+    template<class K, size_t... I>
+    inline void Spread(int32_t* p, int32_t err, int stride, std::index_sequence<I...>) {
+        constexpr int cols = K::Left + 1 + K::Right;
+        (Tap<K, (int)(I / cols), (int)(I % cols)>(p, err, stride), ...);
+    }
+
+    /**
+    <summary>Diffuses the error of the pixel p to all taps of the kernel. Fully unrolled and branch-free.
+    All taps must be inside the image or its ghost border.
+    </summary>
+    */
+    template<class K>
+    inline void Spread(int32_t* p, int32_t err, int stride) {
+        Spread<K>(p, err, stride, std::make_index_sequence<K::Rows * (K::Left + 1 + K::Right)>());
+    }
+
+    /**
+    <summary>Same as Tap(), but for pixels at the border. Taps outside the image are dropped.</summary>
+    */
+    template<class K, int R, int C>
+    inline void TapBorder(int32_t* data, int x, int y, int width, int height, int stride, int32_t err) {
+        if constexpr ((K::W[R][C] != 0) && ((R > 0) || (C > K::Left))) {
+            int tx = x + C - K::Left;
+            if ((tx < 0) || (tx >= width) || (y + R >= height)) { return; }
+            double f = (double)K::W[R][C] / K::Divisor;
+            if constexpr ((K::EdgeDown != 0) && (R == 1) && (C == K::Left)) {
+                if ((x == 0) || (x == width - 1)) { f = (double)K::EdgeDown / K::Divisor; }
+            }
+            data[(y + R) * stride + tx] += (int32_t)(err * f + 0.5);
+        }
+    }
+
+    template<class K, size_t... I>
+    inline void SpreadBorder(int32_t* data, int x, int y, int width, int height, int stride, int32_t err, std::index_sequence<I...>) {
+        constexpr int cols = K::Left + 1 + K::Right;
+        (TapBorder<K, (int)(I / cols), (int)(I % cols)>(data, x, y, width, height, stride, err), ...);
+    }
+
+    /**
+    <summary>Diffuses the error of the pixel (x,y) at the border of the image.</summary>
+    */
+    template<class K>
+    inline void SpreadBorder(int32_t* data, int x, int y, int width, int height, int stride, int32_t err) {
+        SpreadBorder<K>(data, x, y, width, height, stride, err, std::make_index_sequence<K::Rows * (K::Left + 1 + K::Right)>());
+    }
+}
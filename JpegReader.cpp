@@ -0,0 +1,434 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "JpegReader.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+namespace {
+	// Natural[k] is the position (in natural order) of the k-th coefficient of the zigzag sequence
+	const unsigned char Natural[64] = {
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21,
+		28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61,
+		54, 47, 55, 62, 63 };
+
+	const int FastBits = 9;
+
+	struct Huffman {
+		unsigned short fast[1 << FastBits];  // length << 8 | value for the codes up to FastBits, 0 otherwise
+		// For the AC codes with their magnitude bits up to FastBits: coefficient << 8 | run << 4 | length, 0 otherwise
+		short fastAc[1 << FastBits];
+		int maxCode[18];  // the largest code of each length, -1 if there is none
+		int offset[17];  // values[offset[len] + code] is the value of a code of length len
+		unsigned char values[256];
+		bool defined = false;
+
+		// The canonical codes of Annex C: the codes of each length are consecutive
+		bool Build(const unsigned char* bits, const unsigned char* v, int n) {
+			memset(fast, 0, sizeof(fast));
+			memcpy(values, v, n);
+			int code = 0;
+			for (int len = 1, k = 0; len <= 16; len++) {
+				offset[len] = k - code;
+				for (int i = 0; i < bits[len - 1]; i++, k++, code++) {
+					if (code >= (1 << len)) { return false; }  // More codes than fit into len bits
+					if (len <= FastBits) {
+						int first = code << (FastBits - len);
+						for (int j = 0; j < (1 << (FastBits - len)); j++) { fast[first + j] = (unsigned short)(len << 8 | values[k]); }
+					}
+				}
+				maxCode[len] = (bits[len - 1] > 0) ? code - 1 : -1;
+				code <<= 1;
+			}
+			maxCode[17] = INT32_MAX;
+			memset(fastAc, 0, sizeof(fastAc));
+			for (int i = 0; i < (1 << FastBits); i++) {
+				int len = fast[i] >> 8, run = (fast[i] >> 4) & 15, size = fast[i] & 15;
+				if ((len == 0) || (size == 0) || (len + size > FastBits)) { continue; }
+				int m = ((i << len) & ((1 << FastBits) - 1)) >> (FastBits - size);
+				int v = (m < (1 << (size - 1))) ? m - (1 << size) + 1 : m;
+				if ((v >= -128) && (v <= 127)) { fastAc[i] = (short)(v * 256 + run * 16 + len + size); }
+			}
+			defined = true;
+			return true;
+		}
+	};
+
+	struct Component {
+		int id;
+		int h, v;  // sampling factors
+		int tq;  // quantization table
+		Huffman* dc;
+		Huffman* ac;
+		int pred;  // DC prediction
+		int stride;  // of the plane
+		vector<unsigned char> plane;
+	};
+
+	// The basis of the reduced IDCTs: Basis[n][k * n + u] = C(u)/2 cos((2k+1)u pi / 2n) for the sizes n = 1, 2, 4, 8.
+	// With C(0) = 1/sqrt(2) the DC is the same for all sizes, i.e. a pixel of the reduced block is the mean of the
+	// pixels of the full block which it covers, up to the dropped high frequencies.
+	struct Basis {
+		float b[9][64];
+		Basis() {
+			const double pi = 3.14159265358979323846;
+			for (int n = 1; n <= 8; n *= 2) {
+				for (int k = 0; k < n; k++) {
+					for (int u = 0; u < n; u++) {
+						double c = (u == 0) ? sqrt(0.5) : 1.0;
+						b[n][k * n + u] = (float)(c / 2.0 * cos((2 * k + 1) * u * pi / (2.0 * n)));
+					}
+				}
+			}
+		}
+	};
+
+	const Basis& IdctBasis() {
+		static const Basis b;
+		return b;
+	}
+
+	inline unsigned char Clamp(float v) {
+		int i = (int)lrintf(v);
+		return (unsigned char)((i < 0) ? 0 : (i > 255) ? 255 : i);
+	}
+
+	class Decoder {
+	public:
+		Decoder(const unsigned char* data, size_t size) : p(data), end(data + size) {}
+
+		unsigned char* Run(int scale, int& w, int& h, int& channels);
+
+	private:
+		bool ReadHeaders();
+		bool DecodeScan(int n);
+		bool DecodeBlock(Component& c, float* coef, int n);
+		bool Restart();
+		unsigned char* Output(int scale, int& w, int& h, int& channels);
+
+		inline void Fill() {
+			while (count <= 24) {
+				unsigned int b = 0;
+				if ((!marker) && (p < end)) {
+					b = *p;
+					if (b != 0xFF) { p++; }
+					else if ((p + 1 < end) && (p[1] == 0)) { p += 2; }  // a stuffed 0xFF
+					else {  // A marker ends the entropy coded segment, the rest is filled with zeros
+						marker = true;
+						b = 0;
+					}
+				}
+				bits |= b << (24 - count);
+				count += 8;
+			}
+		}
+
+		inline int Get(int n) {
+			if (n == 0) { return 0; }
+			Fill();
+			int v = (int)(bits >> (32 - n));
+			bits <<= n;
+			count -= n;
+			return v;
+		}
+
+		// The value of an n bit magnitude category, Annex F.2.2.1
+		inline int Extend(int n) {
+			int v = Get(n);
+			return (v < (1 << (n - 1))) ? v - (1 << n) + 1 : v;
+		}
+
+		inline int Decode(const Huffman& h) {
+			Fill();
+			int f = h.fast[bits >> (32 - FastBits)];
+			if (f != 0) {
+				bits <<= (f >> 8);
+				count -= (f >> 8);
+				return f & 0xFF;
+			}
+			int len = FastBits + 1;
+			while ((int)(bits >> (32 - len)) > h.maxCode[len]) { len++; }
+			if (len > 16) { return -1; }
+			int code = (int)(bits >> (32 - len));
+			bits <<= len;
+			count -= len;
+			return h.values[h.offset[len] + code];
+		}
+
+		const unsigned char* p;
+		const unsigned char* end;
+		uint32_t bits = 0;
+		int count = 0;
+		bool marker = false;
+
+		unsigned short quant[4][64] = {};  // in zigzag order
+		Huffman dcTables[4];
+		Huffman acTables[4];
+		Component comp[3];
+		int components = 0;
+		int width = 0;
+		int height = 0;
+		int hMax = 1;
+		int vMax = 1;
+		int interval = 0;  // restart interval in MCUs
+		bool rgb = false;  // Adobe transform 0: the components are R, G, B
+	};
+
+	inline int Read16(const unsigned char* s) { return (s[0] << 8) | s[1]; }
+
+	bool Decoder::ReadHeaders() {
+		if ((end - p < 4) || (p[0] != 0xFF) || (p[1] != 0xD8)) { return false; }
+		p += 2;
+		while (end - p >= 4) {
+			if (p[0] != 0xFF) { return false; }
+			int m = p[1];
+			if (m == 0xFF) {  // fill byte
+				p++;
+				continue;
+			}
+			p += 2;
+			if ((m == 0x01) || ((m >= 0xD0) && (m <= 0xD8))) { continue; }
+			if (m == 0xD9) { return false; }  // EOI without a scan
+			int len = Read16(p);
+			if ((len < 2) || (len > end - p)) { return false; }
+			const unsigned char* s = p + 2;
+			const unsigned char* e = p + len;
+			p = e;
+			switch (m) {
+			case 0xDB:  // DQT
+				while (s < e) {
+					int pq = s[0] >> 4, tq = s[0] & 15;
+					if ((pq > 1) || (tq > 3) || (e - s < 1 + 64 * (pq + 1))) { return false; }
+					s++;
+					for (int k = 0; k < 64; k++, s += pq + 1) { quant[tq][k] = (unsigned short)((pq != 0) ? Read16(s) : s[0]); }
+				}
+				break;
+			case 0xC4:  // DHT
+				while (e - s >= 17) {
+					int tc = s[0] >> 4, th = s[0] & 15;
+					if ((tc > 1) || (th > 3)) { return false; }
+					int n = 0;
+					for (int i = 1; i <= 16; i++) { n += s[i]; }
+					if ((n > 256) || (e - s < 17 + n)) { return false; }
+					Huffman& h = (tc == 0) ? dcTables[th] : acTables[th];
+					if (!h.Build(s + 1, s + 17, n)) { return false; }
+					s += 17 + n;
+				}
+				break;
+			case 0xC0:  // SOF0 baseline
+			case 0xC1:  // SOF1 extended sequential, Huffman coded
+				if ((len < 8) || (s[0] != 8)) { return false; }
+				height = Read16(s + 1);
+				width = Read16(s + 3);
+				components = s[5];
+				if ((width == 0) || (height == 0) || ((components != 1) && (components != 3))) { return false; }
+				if (len < 8 + 3 * components) { return false; }
+				for (int i = 0; i < components; i++) {
+					Component& c = comp[i];
+					c.id = s[6 + 3 * i];
+					c.h = s[7 + 3 * i] >> 4;
+					c.v = s[7 + 3 * i] & 15;
+					c.tq = s[8 + 3 * i];
+					if ((c.h < 1) || (c.h > 4) || (c.v < 1) || (c.v > 4) || (c.tq > 3)) { return false; }
+					if (components == 1) { c.h = c.v = 1; }  // A single component is never interleaved
+					if (c.h > hMax) { hMax = c.h; }
+					if (c.v > vMax) { vMax = c.v; }
+				}
+				break;
+			case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:  // progressive, lossless, hierarchical
+			case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:  // arithmetic coding
+				return false;
+			case 0xDD:  // DRI
+				if (len < 4) { return false; }
+				interval = Read16(s);
+				break;
+			case 0xEE:  // APP14 Adobe
+				if ((len >= 14) && (memcmp(s, "Adobe", 5) == 0)) { rgb = (s[11] == 0); }
+				break;
+			case 0xDA: {  // SOS
+				if ((components == 0) || (len < 3) || (s[0] != components) || (len < 6 + 2 * components)) { return false; }
+				for (int i = 0; i < components; i++) {
+					const unsigned char* cs = s + 1 + 2 * i;
+					Component* c = nullptr;
+					for (int j = 0; j < components; j++) {
+						if (comp[j].id == cs[0]) { c = &comp[j]; }
+					}
+					if ((c == nullptr) || ((cs[1] >> 4) > 3) || ((cs[1] & 15) > 3)) { return false; }
+					c->dc = &dcTables[cs[1] >> 4];
+					c->ac = &acTables[cs[1] & 15];
+					if ((!c->dc->defined) || (!c->ac->defined)) { return false; }
+				}
+				const unsigned char* ss = s + 1 + 2 * components;
+				return (ss[0] == 0) && (ss[1] == 63);  // baseline: the full spectrum in one scan
+			}
+			default:  // APPn, COM, ...
+				break;
+			}
+		}
+		return false;
+	}
+
+	bool Decoder::DecodeBlock(Component& c, float* coef, int n) {
+		memset(coef, 0, 64 * sizeof(float));
+		const unsigned short* q = quant[c.tq];
+		int t = Decode(*c.dc);
+		if ((t < 0) || (t > 11)) { return false; }
+		c.pred += (t == 0) ? 0 : Extend(t);
+		coef[0] = (float)(c.pred * q[0]);
+		for (int k = 1; k < 64;) {
+			Fill();
+			int f = c.ac->fastAc[bits >> (32 - FastBits)];
+			int v;
+			if (f != 0) {  // Run, size and magnitude in one lookup
+				bits <<= (f & 15);
+				count -= (f & 15);
+				k += (f >> 4) & 15;
+				v = f >> 8;
+			}
+			else {
+				int rs = Decode(*c.ac);
+				if (rs < 0) { return false; }
+				int r = rs >> 4, s = rs & 15;
+				if (s == 0) {
+					if (r != 15) { break; }  // EOB
+					k += 16;
+					continue;
+				}
+				k += r;
+				v = Extend(s);  // The magnitude bits are read in any case, only the low n x n coefficients are kept
+			}
+			if (k > 63) { return false; }
+			int z = Natural[k];
+			if (((z & 7) < n) && ((z >> 3) < n)) { coef[z] = (float)(v * q[k]); }
+			k++;
+		}
+		return true;
+	}
+
+	bool Decoder::Restart() {
+		bits = 0;
+		count = 0;
+		marker = false;
+		while ((end - p >= 2) && !((p[0] == 0xFF) && (p[1] >= 0xD0) && (p[1] <= 0xD7))) { p++; }
+		if (end - p < 2) { return false; }
+		p += 2;
+		for (int i = 0; i < components; i++) { comp[i].pred = 0; }
+		return true;
+	}
+
+	bool Decoder::DecodeScan(int n) {
+		int mcuCols = (width + 8 * hMax - 1) / (8 * hMax);
+		int mcuRows = (height + 8 * vMax - 1) / (8 * vMax);
+		for (int i = 0; i < components; i++) {
+			Component& c = comp[i];
+			c.pred = 0;
+			c.stride = mcuCols * c.h * n;
+			c.plane.assign((size_t)c.stride * mcuRows * c.v * n, 0);
+		}
+		const float* b = IdctBasis().b[n];
+		float coef[64];
+		float tmp[64];
+		int left = interval;
+		for (int my = 0; my < mcuRows; my++) {
+			for (int mx = 0; mx < mcuCols; mx++) {
+				if (interval > 0) {
+					if (left == 0) {
+						if (!Restart()) { return false; }
+						left = interval;
+					}
+					left--;
+				}
+				for (int i = 0; i < components; i++) {
+					Component& c = comp[i];
+					for (int by = 0; by < c.v; by++) {
+						for (int bx = 0; bx < c.h; bx++) {
+							if (!DecodeBlock(c, coef, n)) { return false; }
+							// Separable n x n IDCT of the low coefficients: first the rows, then the columns
+							for (int v = 0; v < n; v++) {
+								for (int x = 0; x < n; x++) {
+									float s = 0.0f;
+									for (int u = 0; u < n; u++) { s += b[x * n + u] * coef[v * 8 + u]; }
+									tmp[v * 8 + x] = s;
+								}
+							}
+							unsigned char* dst = c.plane.data() + (size_t)((my * c.v + by) * n) * c.stride + (mx * c.h + bx) * n;
+							for (int y = 0; y < n; y++, dst += c.stride) {
+								for (int x = 0; x < n; x++) {
+									float s = 128.0f;
+									for (int v = 0; v < n; v++) { s += b[y * n + v] * tmp[v * 8 + x]; }
+									dst[x] = Clamp(s);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	unsigned char* Decoder::Output(int scale, int& w, int& h, int& channels) {
+		w = (width + scale - 1) / scale;
+		h = (height + scale - 1) / scale;
+		channels = components;
+		unsigned char* out = (unsigned char*)malloc((size_t)w * h * channels);
+		if (out == nullptr) { return nullptr; }
+		if (components == 1) {
+			for (int y = 0; y < h; y++) { memcpy(out + (size_t)y * w, comp[0].plane.data() + (size_t)y * comp[0].stride, w); }
+			return out;
+		}
+		// The subsampled components are repeated
+		vector<int> col[3];
+		for (int i = 0; i < 3; i++) {
+			col[i].resize(w);
+			for (int x = 0; x < w; x++) { col[i][x] = x * comp[i].h / hMax; }
+		}
+		for (int y = 0; y < h; y++) {
+			const unsigned char* s[3];
+			for (int i = 0; i < 3; i++) { s[i] = comp[i].plane.data() + (size_t)(y * comp[i].v / vMax) * comp[i].stride; }
+			unsigned char* d = out + (size_t)y * w * 3;
+			for (int x = 0; x < w; x++, d += 3) {
+				int c0 = s[0][col[0][x]], c1 = s[1][col[1][x]], c2 = s[2][col[2][x]];
+				if (rgb) {
+					d[0] = (unsigned char)c0;
+					d[1] = (unsigned char)c1;
+					d[2] = (unsigned char)c2;
+					continue;
+				}
+				// YCbCr to RGB of JFIF in 16 bit fixed point
+				int cb = c1 - 128, cr = c2 - 128;
+				int yy = (c0 << 16) + (1 << 15);
+				int r = (yy + 91881 * cr) >> 16;
+				int g = (yy - 22554 * cb - 46802 * cr) >> 16;
+				int b = (yy + 116130 * cb) >> 16;
+				d[0] = (unsigned char)((r < 0) ? 0 : (r > 255) ? 255 : r);
+				d[1] = (unsigned char)((g < 0) ? 0 : (g > 255) ? 255 : g);
+				d[2] = (unsigned char)((b < 0) ? 0 : (b > 255) ? 255 : b);
+			}
+		}
+		return out;
+	}
+
+	unsigned char* Decoder::Run(int scale, int& w, int& h, int& channels) {
+		if ((scale != 1) && (scale != 2) && (scale != 4) && (scale != 8)) { return nullptr; }
+		if (!ReadHeaders()) { return nullptr; }
+		if (!DecodeScan(8 / scale)) { return nullptr; }
+		return Output(scale, w, h, channels);
+	}
+}
+
+namespace JpegReader {
+	unsigned char* Decode(const unsigned char* data, size_t size, int scale, int& width, int& height, int& channels) {
+		if (data == nullptr) { return nullptr; }
+		Decoder d(data, size);
+		return d.Run(scale, width, height, channels);
+	}
+}
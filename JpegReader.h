@@ -0,0 +1,37 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstddef>
+
+/**
+<summary>
+    A baseline JPEG decoder which decodes at 1/2, 1/4 or 1/8 of the size directly from the DCT coefficients.
+    Each 8x8 block is transformed with an IDCT of the low NxN coefficients (N = 8/scale), for 1/8 this is just the
+    DC value. So the full resolution image is never built, the IDCT costs a fraction and the planes are smaller.
+    The chroma is upsampled by repetition. This is good enough for previews and proxies, the pixels differ slightly
+    from a full decode which is downscaled afterwards.
+    Only sequential Huffman coded JPEGs with 8 bit samples and 1 or 3 components are supported. For the other
+    formats (progressive, arithmetic, CMYK, non-JPEG files) Decode() fails and the caller decodes at full size.
+</summary>
+*/
+namespace JpegReader {
+    /**
+    <summary>Decodes the image downscaled by scale.</summary>
+    <param name="data">The JPEG file.</param>
+    <param name="size">The size of data in bytes.</param>
+    <param name="scale">1, 2, 4 or 8. The size of the image is divided by scale and rounded up.</param>
+    <param name="width">Receives the width of the decoded image.</param>
+    <param name="height">Receives the height of the decoded image.</param>
+    <param name="channels">Receives 1 for a grayscale and 3 for a RGB image.</param>
+    <returns>The pixels interleaved as by stbi_load(). The buffer is allocated with malloc(), free it with
+    stbi_image_free() or free(). nullptr if the format is not supported or the data is corrupt.</returns>
+    */
+    unsigned char* Decode(const unsigned char* data, size_t size, int scale, int& width, int& height, int& channels);
+}
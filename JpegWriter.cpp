@@ -0,0 +1,269 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "JpegWriter.h"
+#include "Parallel.h"
+#include <fstream>
+using namespace std;
+
+namespace {
+	// ZigZag[i] is the position of the coefficient i (in natural order) in the zigzag sequence
+	const unsigned char ZigZag[64] = {
+		0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42, 3, 8, 12, 17, 25, 30, 41, 43, 9, 11, 18,
+		24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61,
+		35, 36, 48, 49, 57, 58, 62, 63 };
+
+	// The luminance quantization and Huffman tables of the JPEG standard, Annex K
+	const int LuminanceQ[64] = {
+		16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+		18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99 };
+	const unsigned char DcBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+	const unsigned char DcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+	const unsigned char AcBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+	const unsigned char AcValues[162] = {
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+		0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+		0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+		0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa };
+
+	// The scale factors of the AAN DCT
+	const float Aasf[8] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+		1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
+
+	struct Code {
+		unsigned short bits;
+		unsigned short length;
+	};
+
+	struct Huffman {
+		Code dc[256] = {};
+		Code ac[256] = {};
+
+		Huffman() {
+			Build(DcBits, DcValues, dc);
+			Build(AcBits, AcValues, ac);
+		}
+
+		// The canonical codes of Annex C: the codes of each length are consecutive
+		static void Build(const unsigned char* bits, const unsigned char* values, Code* table) {
+			unsigned short code = 0;
+			for (int len = 1, k = 0; len <= 16; len++) {
+				for (int i = 0; i < bits[len - 1]; i++, k++) {
+					table[values[k]] = { code++, (unsigned short)len };
+				}
+				code <<= 1;
+			}
+		}
+	};
+
+	const Huffman& Tables() {
+		static const Huffman h;
+		return h;
+	}
+
+	class BitWriter {
+	public:
+		explicit BitWriter(vector<unsigned char>& o) : out(o) {}
+
+		inline void Put(Code c) {
+			count += c.length;
+			buffer |= (uint32_t)c.bits << (24 - count);
+			while (count >= 8) {
+				unsigned char b = (unsigned char)(buffer >> 16);
+				out.push_back(b);
+				if (b == 0xFF) { out.push_back(0); }  // Byte stuffing
+				buffer <<= 8;
+				count -= 8;
+			}
+		}
+
+		// Pads the last byte with 1 bits
+		void Flush() { Put({ 0x7F, 7 }); }
+
+	private:
+		vector<unsigned char>& out;
+		uint32_t buffer = 0;
+		int count = 0;
+	};
+
+	// The magnitude category and the additional bits of v
+	inline Code Magnitude(int v) {
+		int a = (v < 0) ? -v : v;
+		unsigned short n = 1;
+		while (a >>= 1) { n++; }
+		if (v < 0) { v--; }
+		return { (unsigned short)(v & ((1 << n) - 1)), n };
+	}
+
+	// The AAN forward DCT of 8 values step apart
+	inline void Dct(float* d, int step) {
+		float d0 = d[0], d1 = d[step], d2 = d[2 * step], d3 = d[3 * step];
+		float d4 = d[4 * step], d5 = d[5 * step], d6 = d[6 * step], d7 = d[7 * step];
+		float tmp0 = d0 + d7, tmp7 = d0 - d7;
+		float tmp1 = d1 + d6, tmp6 = d1 - d6;
+		float tmp2 = d2 + d5, tmp5 = d2 - d5;
+		float tmp3 = d3 + d4, tmp4 = d3 - d4;
+		// Even part
+		float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+		float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+		d[0] = tmp10 + tmp11;
+		d[4 * step] = tmp10 - tmp11;
+		float z1 = (tmp12 + tmp13) * 0.707106781f;
+		d[2 * step] = tmp13 + z1;
+		d[6 * step] = tmp13 - z1;
+		// Odd part
+		tmp10 = tmp4 + tmp5;
+		tmp11 = tmp5 + tmp6;
+		tmp12 = tmp6 + tmp7;
+		float z5 = (tmp10 - tmp12) * 0.382683433f;
+		float z2 = tmp10 * 0.541196100f + z5;
+		float z4 = tmp12 * 1.306562965f + z5;
+		float z3 = tmp11 * 0.707106781f;
+		float z11 = tmp7 + z3, z13 = tmp7 - z3;
+		d[5 * step] = z13 + z2;
+		d[3 * step] = z13 - z2;
+		d[step] = z11 + z4;
+		d[7 * step] = z11 - z4;
+	}
+
+	// Transforms, quantizes and writes the 8x8 block du. Returns the DC value for the prediction of the next block.
+	int EncodeBlock(BitWriter& w, float* du, const float* scale, int dc, const Huffman& h) {
+		for (int y = 0; y < 8; y++) { Dct(du + 8 * y, 1); }
+		for (int x = 0; x < 8; x++) { Dct(du + x, 8); }
+		int q[64];
+		for (int i = 0; i < 64; i++) {
+			float v = du[i] * scale[i];
+			q[ZigZag[i]] = (int)((v < 0) ? v - 0.5f : v + 0.5f);
+		}
+		int diff = q[0] - dc;
+		if (diff == 0) {
+			w.Put(h.dc[0]);
+		}
+		else {
+			Code m = Magnitude(diff);
+			w.Put(h.dc[m.length]);
+			w.Put(m);
+		}
+		int last = 63;
+		while ((last > 0) && (q[last] == 0)) { last--; }
+		for (int i = 1; i <= last; i++) {
+			int run = 0;
+			while (q[i] == 0) {
+				run++;
+				i++;
+			}
+			for (; run >= 16; run -= 16) { w.Put(h.ac[0xF0]); }
+			Code m = Magnitude(q[i]);
+			w.Put(h.ac[(run << 4) + m.length]);
+			w.Put(m);
+		}
+		if (last != 63) { w.Put(h.ac[0x00]); }  // End of block
+		return q[0];
+	}
+
+	inline void Put16(vector<unsigned char>& o, int v) {
+		o.push_back((unsigned char)(v >> 8));
+		o.push_back((unsigned char)v);
+	}
+}
+
+namespace JpegWriter {
+	bool EncodeGray(vector<unsigned char>& out, const int32_t* data, int width, int height, int stride, int quality) {
+		if ((data == nullptr) || (width <= 0) || (height <= 0) || (width > 65535) || (height > 65535)) { return false; }
+		quality = (quality < 1) ? 1 : (quality > 100) ? 100 : quality;
+		quality = (quality < 50) ? 5000 / quality : 200 - quality * 2;
+		unsigned char qt[64];  // in zigzag order
+		float scale[64];
+		for (int i = 0; i < 64; i++) {
+			int q = (LuminanceQ[i] * quality + 50) / 100;
+			qt[ZigZag[i]] = (unsigned char)((q < 1) ? 1 : (q > 255) ? 255 : q);
+		}
+		for (int y = 0, i = 0; y < 8; y++) {
+			for (int x = 0; x < 8; x++, i++) { scale[i] = 1.0f / (qt[ZigZag[i]] * Aasf[y] * Aasf[x]); }
+		}
+
+		int mcuCols = (width + 7) / 8;
+		int mcuRows = (height + 7) / 8;
+		int bands = (mcuRows + BandRows - 1) / BandRows;
+		int interval = BandRows * mcuCols;
+		if (interval > 65535) {  // Too wide for restart intervals, the image is one band
+			bands = 1;
+			interval = 0;
+		}
+		int bandRows = (bands == 1) ? mcuRows : BandRows;
+
+		// Headers: SOI, JFIF, DQT, SOF0, DHT, DRI, SOS
+		static const unsigned char jfif[] = { 0xFF, 0xD8, 0xFF, 0xE0, 0, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+		out.assign(jfif, jfif + sizeof(jfif));
+		out.insert(out.end(), { 0xFF, 0xDB, 0, 0x43, 0 });
+		out.insert(out.end(), qt, qt + 64);
+		out.insert(out.end(), { 0xFF, 0xC0, 0, 0x0B, 8 });
+		Put16(out, height);
+		Put16(out, width);
+		out.insert(out.end(), { 1, 1, 0x11, 0 });
+		out.insert(out.end(), { 0xFF, 0xC4 });
+		Put16(out, 2 + 1 + 16 + sizeof(DcValues) + 1 + 16 + sizeof(AcValues));
+		out.push_back(0x00);
+		out.insert(out.end(), DcBits, DcBits + 16);
+		out.insert(out.end(), DcValues, DcValues + sizeof(DcValues));
+		out.push_back(0x10);
+		out.insert(out.end(), AcBits, AcBits + 16);
+		out.insert(out.end(), AcValues, AcValues + sizeof(AcValues));
+		if (interval > 0) {
+			out.insert(out.end(), { 0xFF, 0xDD, 0, 4 });
+			Put16(out, interval);
+		}
+		out.insert(out.end(), { 0xFF, 0xDA, 0, 8, 1, 1, 0, 0, 0x3F, 0 });
+
+		const Huffman& h = Tables();
+		vector<vector<unsigned char>> segment(bands);
+		Parallel::For(0, bands, [&](int from, int to) {
+			for (int b = from; b < to; b++) {
+				vector<unsigned char>& o = segment[b];
+				o.reserve((size_t)bandRows * mcuCols * 64);
+				BitWriter w(o);
+				int dc = 0;
+				int yEnd = (b + 1) * bandRows;
+				for (int my = b * bandRows; (my < yEnd) && (my < mcuRows); my++) {
+					for (int mx = 0; mx < mcuCols; mx++) {
+						float du[64];
+						for (int y = 0, i = 0; y < 8; y++) {
+							int py = 8 * my + y;
+							const int32_t* line = data + (size_t)((py < height) ? py : height - 1) * stride;
+							for (int x = 0; x < 8; x++, i++) {
+								int px = 8 * mx + x;
+								int32_t v = line[(px < width) ? px : width - 1];  // The last line and column are repeated
+								float g = (float)((v < 0) ? 0 : (v > 255) ? 255 : v);
+								// The luminance of R=G=B=g as in stb_image_write, so the rounding is the same
+								du[i] = 0.29900f * g + 0.58700f * g + 0.11400f * g - 128;
+							}
+						}
+						dc = EncodeBlock(w, du, scale, dc, h);
+					}
+				}
+				w.Flush();
+			}
+		});
+		for (int b = 0; b < bands; b++) {
+			if (b > 0) { out.insert(out.end(), { 0xFF, (unsigned char)(0xD0 + ((b - 1) & 7)) }); }
+			out.insert(out.end(), segment[b].begin(), segment[b].end());
+		}
+		out.insert(out.end(), { 0xFF, 0xD9 });
+		return true;
+	}
+
+	bool WriteGray(const string& fileName, const int32_t* data, int width, int height, int stride, int quality) {
+		vector<unsigned char> jpg;
+		if (!EncodeGray(jpg, data, width, height, stride, quality)) { return false; }
+		ofstream f(fileName, ios::binary);
+		f.write((const char*)jpg.data(), jpg.size());
+		return (bool)f;
+	}
+}
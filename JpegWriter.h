@@ -0,0 +1,46 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+<summary>
+    A baseline JPEG encoder for grayscale images. The image is written with one component, so there is no RGB
+    expansion and no chroma to encode.
+    The image is split into bands of BandRows MCU rows. Each band is a restart interval: the DC prediction starts
+    again and the entropy coded segment ends on a byte boundary. So the bands are encoded independently in parallel
+    and joined with RST markers. The bands do not depend on the number of threads, the file is always the same.
+    The DCT, the quantization and the rounding are the same as in stb_image_write, so the decoded pixels are the same
+    as with stbi_write_jpg() of the gray values as RGB.
+</summary>
+*/
+namespace JpegWriter {
+    /**
+    <summary>The height of a restart interval in MCU rows (8 pixel lines).</summary>
+    */
+    const int BandRows = 2;
+
+    /**
+    <summary>Encodes the image. The values are clamped to 0..255.</summary>
+    <param name="out">Receives the JPEG file.</param>
+    <param name="data">The first pixel of the image.</param>
+    <param name="stride">The distance of two lines in data in elements.</param>
+    <param name="quality">1..100, 100 is the highest quality.</param>
+    <returns>false if the image is empty or too large for JPEG (65535 pixels).</returns>
+    */
+    bool EncodeGray(std::vector<unsigned char>& out, const int32_t* data, int width, int height, int stride, int quality = 100);
+    /**
+    <summary>Encodes the image with EncodeGray() and writes it to the file fileName.</summary>
+    <returns>false if the image can not be encoded or the file can not be written.</returns>
+    */
+    bool WriteGray(const std::string& fileName, const int32_t* data, int width, int height, int stride, int quality = 100);
+}
@@ -0,0 +1,223 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "MLGraph.h"
+#include "Calc.h"
+#include "math.h"
+#include <cstring>
+using namespace std;
+
+static const int32_t Gauss5W[5] = { 1, 4, 6, 4, 1 };
+static const int32_t Gauss7W[7] = { 1, 6, 15, 20, 15, 6, 1 };
+
+bool MLGraph::Add(int op, double p1, double p2) {
+	switch (op) {
+	case LOGISTIC:
+	case RESCALE:
+	case INVERT:
+		stages.push_back({ op, 0, p1, p2 });
+		return true;
+	case LAPLACE_SHARPEN:
+	case MEDIAN5:
+	case MEDIAN9:
+	case KNUTH_EDGE:
+	case SALT_PEPPER:
+	case MAJORITY:
+	case GAME_OF_LIFE:
+		stages.push_back({ op, 1, p1, p2 });
+		return true;
+	case GAUSS5:
+		stages.push_back({ GAUSS5_H, 0, p1, p2 });
+		stages.push_back({ GAUSS5_V, 2, p1, p2 });
+		return true;
+	case GAUSS7:
+		stages.push_back({ GAUSS7_H, 0, p1, p2 });
+		stages.push_back({ GAUSS7_V, 3, p1, p2 });
+		return true;
+	}
+	return false;
+}
+
+bool MLGraph::Run(int32_t* d, int w, int h, int s) {
+	if (stages.empty()) { return true; }
+	if ((h <= 0) || (w <= 0)) {
+		Clear();
+		return false;
+	}
+	width = w;
+	height = h;
+	stride = s;
+	out = d;
+	int n = (int)stages.size();
+	int maxRadius = 0;
+	ring.resize(n);
+	produced.assign(n + 1, 0);
+	for (int i = 0; i < n; i++) {
+		ring[i].resize((size_t)(2 * stages[i].radius + 1) * width);
+		maxRadius = (stages[i].radius > maxRadius) ? stages[i].radius : maxRadius;
+	}
+	window.resize(2 * maxRadius + 1);
+	// Level 0 copies the source rows into ring[0]. Level i>0 is stage i-1 and writes to ring[i].
+	// The last level writes directly into data. This is safe, because row y of the source is always read
+	// before row y of the result is written.
+	Ensure(n, height - 1);
+	stages.clear();  // The rings are kept for the next run
+	out = nullptr;
+	return true;
+}
+
+void MLGraph::Ensure(int level, int y) {
+	while (produced[level] <= y) {
+		ProduceRow(level, produced[level]);
+		produced[level]++;
+	}
+}
+
+void MLGraph::ProduceRow(int level, int y) {
+	int n = (int)stages.size();
+	if (level == 0) {
+		memcpy(RingRow(0, y), out + (size_t)y * stride, width * sizeof(int32_t));
+		return;
+	}
+	const Stage& s = stages[level - 1];
+	int r = s.radius;
+	Ensure(level - 1, (y + r < height) ? y + r : height - 1);
+	const int32_t** w = window.data();
+	for (int dy = -r; dy <= r; dy++) {
+		int py = y + dy;
+		py = (py < 0) ? 0 : (py < height) ? py : height - 1;
+		w[r + dy] = RingRow(level - 1, py);
+	}
+	int32_t* o = (level == n) ? out + (size_t)y * stride : RingRow(level, y);
+	Kernel(s, w, y, o);
+}
+
+void MLGraph::Kernel(const Stage& s, const int32_t* const* w, int y, int32_t* o) {
+	const int32_t* c = w[s.radius];
+	bool border = (y == 0) || (y == height - 1);
+	if (s.op == LOGISTIC) {
+		for (int x = 0; x < width; x++) {
+			double v = (c[x] - 128) * s.p1;
+			v = 1.0 / (1.0 + exp(-v));
+			o[x] = (int32_t)(WHITE * v + 0.5);
+		}
+	}
+	else if (s.op == RESCALE) {
+		memcpy(o, c, width * sizeof(int32_t));
+		if (border) { return; }
+		for (int x = 1; x < width - 1; x++) {
+			o[x] = (int32_t)(s.p1 + s.p2 * c[x] + 0.5);
+		}
+	}
+	else if (s.op == INVERT) {
+		for (int x = 0; x < width; x++) {
+			o[x] = c[x] ^ WHITE;
+		}
+	}
+	else if (s.op == LAPLACE_SHARPEN) {
+		memcpy(o, c, width * sizeof(int32_t));
+		if (border) { return; }
+		const int32_t* u = w[0];
+		const int32_t* b = w[2];
+		for (int x = 1; x < width - 1; x++) {
+			int32_t lap33 = u[x - 1] + u[x] + u[x + 1] + c[x - 1] - 8 * c[x] + c[x + 1] + b[x - 1] + b[x] + b[x + 1];
+			o[x] = c[x] + (int32_t)(s.p1 * lap33 + 0.5);
+		}
+	}
+	else if (s.op == MEDIAN5) {
+		memcpy(o, c, width * sizeof(int32_t));
+		if (border) { return; }
+		for (int x = 1; x < width - 1; x++) {
+			o[x] = Median5(w[0][x], c[x - 1], c[x], c[x + 1], w[2][x]);
+		}
+	}
+	else if (s.op == MEDIAN9) {
+		memcpy(o, c, width * sizeof(int32_t));
+		if (border) { return; }
+		const int32_t* u = w[0];
+		const int32_t* b = w[2];
+		for (int x = 1; x < width - 1; x++) {
+			o[x] = Median9(u[x - 1], u[x], u[x + 1], c[x - 1], c[x], c[x + 1], b[x - 1], b[x], b[x + 1]);
+		}
+	}
+	else if (s.op == KNUTH_EDGE) {
+		const double denom = 1.0 - s.p1;
+		o[0] = c[0];
+		o[width - 1] = c[width - 1];
+		for (int x = 1; x < width - 1; x++) {
+			double mx = (double)Accumulate33(w, x, y, true) / 9.0;
+			o[x] = (int32_t)((c[x] - s.p1 * mx) / denom + 0.5);
+		}
+	}
+	else if ((s.op == GAUSS5_H) || (s.op == GAUSS7_H)) {
+		int r = (s.op == GAUSS5_H) ? 2 : 3;
+		const int32_t* g = (s.op == GAUSS5_H) ? Gauss5W : Gauss7W;
+		for (int x = 0; x < width; x++) {
+			int32_t v = 0;
+			if ((x >= r) && (x < width - r)) {
+				for (int k = -r; k <= r; k++) { v += g[r + k] * c[x + k]; }
+			}
+			else {  // Replicates the border pixels
+				for (int k = -r; k <= r; k++) {
+					int px = x + k;
+					px = (px < 0) ? 0 : (px < width) ? px : width - 1;
+					v += g[r + k] * c[px];
+				}
+			}
+			o[x] = v;
+		}
+	}
+	else if ((s.op == GAUSS5_V) || (s.op == GAUSS7_V)) {
+		int r = (s.op == GAUSS5_V) ? 2 : 3;
+		const int32_t* g = (s.op == GAUSS5_V) ? Gauss5W : Gauss7W;
+		int32_t norm = (s.op == GAUSS5_V) ? 256 : 4096;
+		for (int x = 0; x < width; x++) {
+			int32_t v = 0;
+			for (int k = 0; k <= 2 * r; k++) { v += g[k] * w[k][x]; }
+			o[x] = v / norm;
+		}
+	}
+	else if (s.op == SALT_PEPPER) {
+		int32_t wthreshold = (int32_t)s.p1 * WHITE;
+		int32_t bthreshold = (9 - (int32_t)s.p1) * WHITE;
+		for (int x = 0; x < width; x++) {
+			int32_t v = c[x];
+			int32_t a = Accumulate33(w, x, y, true);
+			o[x] = v;
+			if (v == WHITE) {
+				if (a <= wthreshold) { o[x] = BLACK; }
+			}
+			else {
+				if (a >= bthreshold) { o[x] = WHITE; }
+			}
+		}
+	}
+	else if (s.op == MAJORITY) {
+		const int32_t W5 = 5 * WHITE;
+		for (int x = 0; x < width; x++) {
+			o[x] = (Accumulate33(w, x, y, true) >= W5) ? WHITE : BLACK;
+		}
+	}
+	else if (s.op == GAME_OF_LIFE) {
+		bool whiteAlife = (s.p1 != 0.0);
+		const int32_t W2 = 2 * WHITE;
+		const int32_t W3 = 3 * WHITE;
+		const int32_t W8 = 8 * WHITE;
+		int32_t life = (whiteAlife) ? WHITE : BLACK;
+		int32_t dead = (whiteAlife) ? BLACK : WHITE;
+		for (int x = 0; x < width; x++) {
+			int32_t a = Accumulate33(w, x, y, false);
+			if (whiteAlife) { a = W8 - a; }
+			if (c[x] == life) {
+				o[x] = ((a == W2) || (a == W3)) ? life : dead;
+			}
+			else {
+				o[x] = (a == W3) ? life : dead;
+			}
+		}
+	}
+}
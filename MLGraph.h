@@ -0,0 +1,118 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+<summary>
+    The deferred operation graph of MLGray. In lazy mode (see MLGray::SetLazy()) the point- and neighborhood-filters
+    are not executed immediately, but recorded as stages in this graph. Run() executes all recorded stages in a single
+    fused pass over the image: Each stage keeps only a small ring of the rows the next stage needs (2*radius+1 lines).
+    The image is read once and written once, independent of the number of stages.
+    E.g. Med5Laplace() followed by SaltPepper() needs 1 instead of 3 copies and 3 passes.
+    Halftoning is inherently a full-frame operation. It is a barrier and materializes the graph.
+    The results are bit-identical to the immediate execution of the same operations.
+</summary>
+*/
+class MLGraph
+{
+public:
+    /**
+    <summary>The operations which can be recorded. The parameters p1, p2 have the meaning of the corresponding MLGray method</summary>
+    */
+    enum Op {
+        LOGISTIC,         // p1: scale
+        RESCALE,          // p1: offset, p2: factor
+        INVERT,
+        LAPLACE_SHARPEN,  // p1: factor
+        MEDIAN5,
+        MEDIAN9,
+        KNUTH_EDGE,       // p1: factor
+        GAUSS5,
+        GAUSS7,
+        SALT_PEPPER,      // p1: threshold
+        MAJORITY,
+        GAME_OF_LIFE      // p1: whiteAlive (0 or 1), one stage per generation
+    };
+    /**
+    <summary>Records an operation. Separable filters are split into a horizontal and a vertical stage.</summary>
+    <returns>true if op is a valid operation</returns>
+    */
+    bool Add(int op, double p1 = 0.0, double p2 = 0.0);
+    /**
+    <returns>true if there are no pending operations</returns>
+    */
+    bool Empty() { return stages.empty(); }
+    /**
+    <summary>Discards all pending operations.</summary>
+    */
+    void Clear() { stages.clear(); }
+    /**
+    <summary>Executes the recorded stages as a single fused pass over data and clears the graph.</summary>
+    <param name="data">The image data. It is overwritten with the result</param>
+    <param name="width">width of image</param>
+    <param name="height">height of image</param>
+    <param name="stride">distance of two lines of data</param>
+    <returns>true if operation successfull, false if image is empty</returns>
+    */
+    bool Run(int32_t* data, int width, int height, int stride);
+
+private:
+    const int32_t BLACK = 0;
+    const int32_t WHITE = 255;
+    // Internal stage ids of the separable Gauss filters
+    const int GAUSS5_H = 100;
+    const int GAUSS5_V = 101;
+    const int GAUSS7_H = 102;
+    const int GAUSS7_V = 103;
+
+    struct Stage {
+        int op;
+        int radius;  // number of lines above and below the current line the stage reads
+        double p1;
+        double p2;
+    };
+    std::vector<Stage> stages;
+    // Execution state of Run()
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    int32_t* out = nullptr;
+    std::vector<std::vector<int32_t>> ring;  // ring[i] holds the rows of the input of stage i
+    std::vector<int> produced;               // produced[i] number of rows in ring[i] so far
+    std::vector<const int32_t*> window;
+
+    void Ensure(int level, int y);
+    void ProduceRow(int level, int y);
+    inline int32_t* RingRow(int level, int y) {
+        int cap = 2 * stages[level].radius + 1;
+        return ring[level].data() + (std::size_t)(y % cap) * width;
+    }
+    /**
+    <summary>Calculates one row of a stage.</summary>
+    <param name="w">The input rows y-radius ... y+radius. Rows outside the image are replaced by the nearest border row</param>
+    <param name="y">the row index</param>
+    <param name="o">the output row</param>
+    */
+    void Kernel(const Stage& s, const int32_t* const* w, int y, int32_t* o);
+    inline int32_t Accumulate33(const int32_t* const* w, int x, int y, bool center) {
+        int32_t v = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            if ((y + dy < 0) || (y + dy >= height)) { continue; }
+            const int32_t* r = w[1 + dy];
+            if (x > 0) { v += r[x - 1]; }
+            if (center || (dy != 0)) { v += r[x]; }
+            if (x < width - 1) { v += r[x + 1]; }
+        }
+        return v;
+    }
+};
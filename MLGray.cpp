@@ -6,9 +6,21 @@
 *
 ***********************************************************************/
 #include "MLGray.h"
+#include "MLGraph.h"
+#include "Diffusion.h"
+#include "BlueNoise.h"
+#include "Bayer.h"
+#include "PixelRandom.h"
+#include "Parallel.h"
+#include "BlurScore.h"
+#include "Arena.h"
+#include "JpegReader.h"
+#include "JpegWriter.h"
+#include "Synthetic.h"
+#include "Trace.h"
 #include "math.h"
+#include <chrono>
 #include <iostream>
-#include <random>
 #include <algorithm>
 #include <vector>
 using namespace std;
@@ -22,6 +34,13 @@ using namespace std;
 
 #pragma warning(disable : 26451)
 
+// The frame is PAD elements (64 bytes) in front of the first ghost line. PAD covers the left ghost border of line 0.
+static const int PAD = 16;
+
+static inline int Stride(int w) {
+	return (w + 2 * MLGray::GHOST + PAD - 1) / PAD * PAD;
+}
+
 MLGray::MLGray() {
 	width = 0;
 	height = 0;
@@ -29,48 +48,282 @@ MLGray::MLGray() {
 }
 
 MLGray::MLGray(int w, int h) {
+	data = nullptr;
+	Allocate(w, h);
+}
+
+MLGray::MLGray(int w,int h,int32_t *srcdata) {
+	data = nullptr;
+	Allocate(w, h);
+	for (int y = 0; y < height; y++) {
+		memcpy(data + line(y), srcdata + (size_t)y * width, width * sizeof(int32_t));
+	}
+}
+
+MLGray::MLGray(MLGray&& other) noexcept {
+	width = other.width;
+	height = other.height;
+	stride = other.stride;
+	data = other.data;
+	frame = other.frame;
+	graph = other.graph;
+	other.width = 0;
+	other.height = 0;
+	other.stride = 0;
+	other.data = nullptr;
+	other.frame = nullptr;
+	other.graph = nullptr;
+}
+
+MLGray& MLGray::operator=(MLGray&& other) noexcept {
+	if (this != &other) {
+		Arena::Release(frame);
+		delete graph;
+		width = other.width;
+		height = other.height;
+		stride = other.stride;
+		data = other.data;
+		frame = other.frame;
+		graph = other.graph;
+		other.width = 0;
+		other.height = 0;
+		other.stride = 0;
+		other.data = nullptr;
+		other.frame = nullptr;
+		other.graph = nullptr;
+	}
+	return *this;
+}
+
+void MLGray::Swap(MLGray& other) noexcept {
+	std::swap(width, other.width);
+	std::swap(height, other.height);
+	std::swap(stride, other.stride);
+	std::swap(data, other.data);
+	std::swap(frame, other.frame);
+}
+
+MLGray::~MLGray() {
+	Arena::Release(frame);
+	delete graph;
+}
+
+bool MLGray::Allocate(int w, int h, int s) {
 	width = w;
 	height = h;
-	data = new int32_t[width * height];
+	stride = (s > 0) ? s : Stride(w);
+	size_t bytes = (PAD + (size_t)(height + 2 * GHOST) * stride) * sizeof(int32_t);
+	if (Arena::Capacity(frame) < bytes) {
+		Arena::Release(frame);
+		frame = (int32_t*)Arena::Acquire(bytes);
+	}
+	if (frame == nullptr) {
+		data = nullptr;
+		return false;
+	}
+	data = frame + PAD + GHOST * stride;
+	return true;
 }
 
-MLGray::MLGray(int w,int h,int32_t *srcdata) {
+void MLGray::FillBorder(int mode) {
+	if ((height <= 0) || (width <= 0)) { return; }
+	// Maps the ghost position -k resp. width-1+k to the source pixel
+	auto src = [mode](int k, int n) {
+		if (mode == REFLECT) { return (k < n) ? k : n - 1; }
+		return 0;
+	};
+	for (int y = 0; y < height; y++) {
+		int32_t* d = data + line(y);
+		for (int k = 1; k <= GHOST; k++) {
+			d[-k] = (mode == ZERO) ? BLACK : d[src(k, width)];
+			d[width - 1 + k] = (mode == ZERO) ? BLACK : d[width - 1 - src(k, width)];
+		}
+	}
+	const size_t n = (width + 2 * GHOST) * sizeof(int32_t);
+	for (int k = 1; k <= GHOST; k++) {
+		int32_t* top = data + line(-k) - GHOST;
+		int32_t* bottom = data + line(height - 1 + k) - GHOST;
+		if (mode == ZERO) {
+			memset(top, 0, n);
+			memset(bottom, 0, n);
+			continue;
+		}
+		memcpy(top, data + line(src(k, height)) - GHOST, n);
+		memcpy(bottom, data + line(height - 1 - src(k, height)) - GHOST, n);
+	}
+}
+
+MLGray MLGray::View(int x, int y, int w, int h) {
+	MLGray v;
+	if (!Materialize()) { return v; }
+	int x1 = (x + w < width) ? x + w : width;
+	int y1 = (y + h < height) ? y + h : height;
+	x = (x > 0) ? x : 0;
+	y = (y > 0) ? y : 0;
+	if ((x >= x1) || (y >= y1)) { return v; }
+	v.width = x1 - x;
+	v.height = y1 - y;
+	v.stride = stride;
+	v.data = data + pos(x, y);
+	return v;
+}
+
+template<class F>
+bool MLGray::Detached(F op) {
+	MLGray t = MLGray(width, height);
+	CopyTo(t);
+	bool ok = op(t);
+	t.CopyTo(*this);
+	return ok;
+}
+
+void MLGray::Replace(MLGray& t) {
+	if (IsView()) {
+		t.CopyTo(*this);
+		return;
+	}
+	Swap(t);
+}
+
+MLGray MLGray::Clone() {
+	Materialize();
+	MLGray t = Buffer();
+	CopyTo(t);
+	if (graph != nullptr) { t.SetLazy(); }
+	return t;
+}
+
+void MLGray::CopyTo(MLGray& dst) {
+	for (int y = 0; y < height; y++) {
+		memcpy(dst.data + dst.line(y), data + line(y), width * sizeof(int32_t));
+	}
+}
+
+void MLGray::SetLazy(bool on) {
+	if (on) {
+		if (graph == nullptr) { graph = new MLGraph(); }
+		return;
+	}
+	Materialize();
+	delete graph;
+	graph = nullptr;
+}
+
+bool MLGray::Materialize() {
+	if ((graph == nullptr) || graph->Empty()) { return true; }
+	Trace::Scope s("Materialize");
+	return graph->Run(data, width, height, stride);
+}
+
+bool MLGray::Defer(int op, double p1, double p2) {
+	return graph->Add(op, p1, p2);
+}
+
+// Reduces the stb image d in place to the box means of scale x scale pixels. The boxes at the right and bottom
+// border may be smaller.
+static void Shrink(unsigned char* d, int& width, int& height, int channels, int scale) {
+	int w = (width + scale - 1) / scale;
+	int h = (height + scale - 1) / scale;
+	// The box of an output pixel starts at or behind the pixel, so the pixels are read before they are overwritten
+	for (int y = 0; y < h; y++) {
+		int y1 = std::min((y + 1) * scale, height);
+		for (int x = 0; x < w; x++) {
+			int x1 = std::min((x + 1) * scale, width);
+			int n = (y1 - y * scale) * (x1 - x * scale);
+			for (int c = 0; c < channels; c++) {
+				int sum = 0;
+				for (int sy = y * scale; sy < y1; sy++) {
+					for (int sx = x * scale; sx < x1; sx++) { sum += d[((size_t)sy * width + sx) * channels + c]; }
+				}
+				d[((size_t)y * w + x) * channels + c] = (unsigned char)((sum + n / 2) / n);
+			}
+		}
+	}
 	width = w;
 	height = h;
-	int sz = width * height;
-	data = new int32_t[sz];
-	memcpy(data, srcdata, sz * sizeof(int32_t));
 }
 
-MLGray::~MLGray() {
-	delete[] data;
+// The time of the last LoadImage() of the thread
+static thread_local double decodeMs = 0.0;
+
+double MLGray::LastDecodeMs() {
+	return decodeMs;
 }
 
-unsigned char* MLGray::LoadImage(string fileName, int& width, int& height, int& channels) {
-	return stbi_load(fileName.c_str(),&width,&height,&channels,0);
+unsigned char* MLGray::LoadImage(const MLSource& src, int& width, int& height, int& channels) {
+	Trace::Scope s("Decode");
+	if (Trace::Enabled()) { s.Detail((src.Data() != nullptr) ? "buffer" : src.FileName()); }
+	auto start = std::chrono::steady_clock::now();
+	unsigned char* d = Decode(src, width, height, channels);
+	decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return d;
+}
+
+unsigned char* MLGray::Decode(const MLSource& src, int& width, int& height, int& channels) {
+	int scale = src.Scale();
+	if ((scale != 2) && (scale != 4) && (scale != 8)) { scale = 1; }
+	unsigned char* d = nullptr;
+	if ((src.Data() == nullptr) && Synthetic::IsSpec(src.FileName())) {
+		return Synthetic::Generate(src.FileName(), scale, width, height, channels);
+	}
+	if (src.Data() != nullptr) {
+		if (scale > 1) { d = JpegReader::Decode(src.Data(), src.Size(), scale, width, height, channels); }
+		if (d != nullptr) { return d; }
+		d = stbi_load_from_memory(src.Data(), (int)src.Size(), &width, &height, &channels, 0);
+	}
+	else {
+		MappedFile f(src.FileName());
+		if (f.Data() != nullptr) {
+			if (scale > 1) { d = JpegReader::Decode(f.Data(), f.Size(), scale, width, height, channels); }
+			if (d != nullptr) { return d; }
+			d = stbi_load_from_memory(f.Data(), (int)f.Size(), &width, &height, &channels, 0);
+		}
+		else {
+			d = stbi_load(src.FileName().c_str(), &width, &height, &channels, 0);
+		}
+	}
+	// E.g. a progressive JPEG or a PNG: decoded at full size
+	if ((d != nullptr) && (scale > 1)) { Shrink(d, width, height, channels, scale); }
+	return d;
 }
 
 bool MLGray::CopyData(const unsigned char* d) {
-	int sz = width * height;
-	for (int n = 0; n < sz; n++) {
-		data[n] = (int32_t)d[n];
+	for (int y = 0; y < height; y++) {
+		int32_t* p = data + line(y);
+		const unsigned char* s = d + (size_t)y * width;
+		for (int x = 0; x < width; x++) {
+			p[x] = (int32_t)s[x];
+		}
 	}
 	return true;
 }
 
+MLGray MLGray::Buffer() {
+	MLGray t;
+	t.Allocate(width, height, stride);
+	return t;
+}
+
+void MLGray::CopyBorder(int32_t* dst) {
+	if ((height <= 0) || (width <= 0)) { return; }
+	memcpy(dst, data, width * sizeof(int32_t));
+	memcpy(dst + line(height - 1), data + line(height - 1), width * sizeof(int32_t));
+	for (int y = 1; y < height - 1; y++) {
+		int lpos = line(y);
+		dst[lpos] = data[lpos];
+		dst[lpos + width - 1] = data[lpos + width - 1];
+	}
+}
+
 bool MLGray::CreateImage(int w, int h) {
-	width = w;
-	height = h;
-	if (data != nullptr) { delete[] data; }
-	data = new int32_t[width * height];
-	if (data == nullptr) { return false; }
-	return true;
+	if (graph != nullptr) { graph->Clear(); } // Pending operations belong to the previous image
+	return Allocate(w, h);
 }
 
-bool MLGray::ColorChannel(const string fileName, int color) {
+bool MLGray::ColorChannel(const MLSource& src, int color) {
 	if ((color < RED) || (color > BLUE)) { return false; }
 	int ch, w, h;
-	unsigned char* d = LoadImage(fileName, w, h, ch);
+	unsigned char* d = LoadImage(src, w, h, ch);
 	if (d == nullptr) { return false; }
 	CreateImage(w, h);
 	if (ch == 1) { 
@@ -79,7 +332,7 @@ bool MLGray::ColorChannel(const string fileName, int color) {
 	else {
 		for (int y = 0; y < height; y++) {
 			int lpos = line(y);
-			int lpStb = lpos * ch;
+			int lpStb = y * width * ch;
 			for (int x = 0; x < width; x++) {
 				int px = lpos + x;
 				int pxStb = lpStb + x * ch;
@@ -92,9 +345,9 @@ bool MLGray::ColorChannel(const string fileName, int color) {
 }
 
 
-bool MLGray::Saturate(string fileName, double wRed, double wGreen, double wBlue) {
+bool MLGray::Saturate(const MLSource& src, double wRed, double wGreen, double wBlue) {
 	int ch,w,h;
-	unsigned char* d = LoadImage(fileName, w, h, ch);
+	unsigned char* d = LoadImage(src, w, h, ch);
 	if (d == nullptr) { return false; }
 	CreateImage(w, h);
 	if (ch == 1) { 
@@ -104,7 +357,7 @@ bool MLGray::Saturate(string fileName, double wRed, double wGreen, double wBlue)
 		int32_t r, g, b;
 		for (int y = 0; y < height; y++) {
 			int lpos = line(y);
-			int lpStb = lpos * ch;
+			int lpStb = y * width * ch;
 			for (int x = 0; x < width; x++) {
 				int px = lpos + x;
 				int pxStb = lpStb + x * ch;
@@ -119,19 +372,19 @@ bool MLGray::Saturate(string fileName, double wRed, double wGreen, double wBlue)
 	return true;
 }
 
-bool MLGray::SaturateGIMP(const string fileName,double scaleFactor) {
-	return Saturate(fileName, 0.3*scaleFactor,0.596*scaleFactor,0.11*scaleFactor);
+bool MLGray::SaturateGIMP(const MLSource& src,double scaleFactor) {
+	return Saturate(src, 0.3*scaleFactor,0.596*scaleFactor,0.11*scaleFactor);
 }
 
-bool MLGray::SaturateQt(const string fileName,double scaleFac) {
-	return Saturate(fileName, 0.34375*scaleFac, 0.5 * scaleFac, 0.1625 * scaleFac);
+bool MLGray::SaturateQt(const MLSource& src,double scaleFac) {
+	return Saturate(src, 0.34375*scaleFac, 0.5 * scaleFac, 0.1625 * scaleFac);
 }
 
-bool MLGray::Desaturate(const string fileName) {
-	int ch;
-	unsigned char* d = LoadImage(fileName, width, height, ch);
+bool MLGray::Desaturate(const MLSource& src) {
+	int ch, w, h;
+	unsigned char* d = LoadImage(src, w, h, ch);
 	if (d == nullptr) { return false; }
-	data = new int32_t[width * height];
+	CreateImage(w, h);
 	if (ch == 1) { 
 		CopyData(d); 
 	}
@@ -139,7 +392,7 @@ bool MLGray::Desaturate(const string fileName) {
 		int32_t g, b;
 		for (int y = 0; y < height; y++) {
 			int lpos = line(y);
-			int lpStb = lpos * ch;
+			int lpStb = y * width * ch;
 			for (int x = 0; x < width; x++) {
 				int px = lpos + x;
 				int pxStb = lpStb + x * ch;
@@ -159,11 +412,11 @@ bool MLGray::Desaturate(const string fileName) {
 	return true;
 }
 
-bool MLGray::Value(const string fileName) {
-	int ch;
-	unsigned char* d = LoadImage(fileName, width, height, ch);
+bool MLGray::Value(const MLSource& src) {
+	int ch, w, h;
+	unsigned char* d = LoadImage(src, w, h, ch);
 	if (d == nullptr) { return false; }
-	data = new int32_t[width * height];
+	CreateImage(w, h);
 	if (ch == 1) { 
 		CopyData(d); 
 	}
@@ -171,7 +424,7 @@ bool MLGray::Value(const string fileName) {
 		int32_t g, b;
 		for (int y = 0; y < height; y++) {
 			int lpos = line(y);
-			int lpStb = lpos * ch;
+			int lpStb = y * width * ch;
 			for (int x = 0; x < width; x++) {
 				int px = lpos + x;
 				int pxStb = lpStb + x * ch;
@@ -188,11 +441,11 @@ bool MLGray::Value(const string fileName) {
 	return true;
 }
 
-bool MLGray::Helmholtz(const string fileName,double factor) {
-	int ch;
-	unsigned char* d = LoadImage(fileName, width, height, ch);
+bool MLGray::Helmholtz(const MLSource& src,double factor) {
+	int ch, w, h;
+	unsigned char* d = LoadImage(src, w, h, ch);
 	if (d == nullptr) { return false; }
-	data = new int32_t[width * height];
+	CreateImage(w, h);
 	if (ch == 1) { 
 		CopyData(d); 
 	}
@@ -200,7 +453,7 @@ bool MLGray::Helmholtz(const string fileName,double factor) {
 		int32_t R, G, B;
 		for (int y = 0; y < height; y++) {
 			int lpos = line(y);
-			int lpStb = lpos * ch;
+			int lpStb = y * width * ch;
 			for (int x = 0; x < width; x++) {
 				int px = lpos + x;
 				int pxStb = lpStb + x * ch;
@@ -220,6 +473,7 @@ bool MLGray::Helmholtz(const string fileName,double factor) {
 
 bool MLGray::Logistic(double scale) {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::LOGISTIC, scale); }
 	for (int y = 0; y < height; y++) {
 		int lpos = line(y);
 		for (int x = 0; x < width; x++) {
@@ -232,291 +486,198 @@ bool MLGray::Logistic(double scale) {
 	return true;
 }
 
-bool MLGray::Jarvis(int32_t threshold) {
+template<class K>
+bool MLGray::ErrorDiffusion(int32_t threshold) {
 	if ((height <= 1) || (width <= 1)) { return false; }
-	const double f7 = 7.0 / 48.0;
-	const double f5 = 5.0 / 48.0;
-	const double f3 = 3.0 / 48.0;
-	const double f1 = 1.0 / 48.0;
-	int lpos;
-	int px;
-	// Ghost row at top. Propagates the error down to first row
-	int32_t* tmp = new int32_t[width];
-	memcpy(tmp, data, width * sizeof(int32_t));
-	for (int x = 0; x < width - 1; x++) {
-		int32_t v = tmp[x];
-		int err = (v < threshold) ? v : WHITE - v;
-		data[x + 1] += (int32_t)(err * f7 + 0.5);
-		data[x] += (int32_t)(err * f7 + 0.5);
+	if (!Materialize()) { return false; }
+	if (IsView()) { return Detached([&](MLGray& t) { return t.ErrorDiffusion<K>(threshold); }); }
+	constexpr double fRight = (double)K::W[0][K::Left + 1] / K::Divisor;
+	constexpr double fDown = (double)K::W[1][K::Left] / K::Divisor;
+	// Ghost row at top. Propagates the error down to first row.
+	// Runs from right to left, so data[x] is still the original value when it is read.
+	for (int x = width - 2; x >= 0; x--) {
+		int32_t v = data[x];
+		int32_t err = (v < threshold) ? v : WHITE - v;
+		data[x + 1] += (int32_t)(err * fRight + 0.5);
+		data[x] += (int32_t)(err * fDown + 0.5);
 	}
+	static_assert((K::Left <= GHOST) && (K::Right <= GHOST) && (K::Rows - 1 <= GHOST), "Kernel larger than ghost border");
+	// The taps outside the image write into the ghost border. Only the EdgeDown weight of the first and last column
+	// needs an own path.
+	const int xl = (K::EdgeDown == 0) ? 0 : (width > 1) ? 1 : width;
+	const int xr = (width - xl > xl) ? width - xl : xl;
 	for (int y = 0; y < height; y++) {
-		lpos = line(y);
-		for (int x = 0; x < width; x++) {
-			px = lpos + x;
-			int32_t v = data[px];
-			data[px] = (v < threshold) ? BLACK : WHITE;
-			int32_t err = v - data[px];
-			if (x < width - 1) {
-				data[px + 1] += (int32_t)(err * f7 + 0.5);
-				if (y < height - 1) {
-					data[px + width+1] += (int32_t)(err * f5 + 0.5);
-					if (y < height - 2) {
-						data[px + 2*width + 1] += (int32_t)(err * f3 + 0.5);
-					}
-				}
-				if (x < width - 2) {
-					data[px + 2] += (int32_t)(err * f5 + 0.5);
-					if (y < height - 1) {
-						data[px + width + 2] += (int32_t)(err * f3 + 0.5);
-						if (y < height - 2) {
-							data[px + 2 * width + 2] += (int32_t)(err * f1 + 0.5);
-						}
-					}
-				}
-			}
-			if (y < height - 1) { 
-				data[px + width] += (int32_t)(err * f7 + 0.5); 
-				if(y<height-2) { data[px + 2*width] += (int32_t)(err * f5 + 0.5); }
-			}
-			if (x>0) {
-				if (y < height - 1) {
-					data[px + width - 1] += (int32_t)(err * f5 + 0.5);
-					if (y < height - 2) { data[px + 2*width - 1] += (int32_t)(err * f3 + 0.5); }
-				}
-				if (x > 1) {
-					if (y < height - 1) {
-						data[px + width - 2] += (int32_t)(err * f3 + 0.5);
-						if (y < height - 2) { data[px + 2 * width - 2] += (int32_t)(err * f1 + 0.5); }
-					}
-
-				}
-			}
-
+		int lpos = line(y);
+		int x = 0;
+		for (; x < xl; x++) {
+			int32_t v = data[lpos + x];
+			data[lpos + x] = (v < threshold) ? BLACK : WHITE;
+			Diffusion::SpreadBorder<K>(data, x, y, width, height, stride, v - data[lpos + x]);
+		}
+		for (; x < xr; x++) {
+			int32_t* p = data + lpos + x;
+			int32_t v = *p;
+			*p = (v < threshold) ? BLACK : WHITE;
+			Diffusion::Spread<K>(p, v - *p, stride);
+		}
+		for (; x < width; x++) {
+			int32_t v = data[lpos + x];
+			data[lpos + x] = (v < threshold) ? BLACK : WHITE;
+			Diffusion::SpreadBorder<K>(data, x, y, width, height, stride, v - data[lpos + x]);
 		}
 	}
-	delete[] tmp;
 	return true;
 }
 
-/*
-      .   .   x   8   4
-      2   4   8   4   2
-      1   2   4   2   1
-*/
+bool MLGray::FloydSteinberg(int32_t threshold) {
+	return ErrorDiffusion<FloydSteinbergKernel>(threshold);
+}
 
-bool MLGray::Stucki(int32_t threshold) {
-	if ((height <= 1) || (width <= 1)) { return false; }
-	const double f8 = 8.0 / 42.0;
-	const double f4 = 4.0 / 42.0;
-	const double f2 = 2.0 / 42.0;
-	const double f1 = 1.0 / 42.0;
-	int lpos;
-	int px;
-	// Ghost row at top. Propagates the error down to first row
-	int32_t* tmp = new int32_t[width];
-	memcpy(tmp, data, width * sizeof(int32_t));
-	for (int x = 0; x < width - 1; x++) {
-		int32_t v = tmp[x];
-		int err = (v < threshold) ? v : WHITE - v;
-		data[x + 1] += (int32_t)(err * f8  + 0.5);
-		data[x] += (int32_t)(err * f8 + 0.5);
-	}
-	for (int y = 0; y < height; y++) {
-		lpos = line(y);
-		for (int x = 0; x < width; x++) {
-			px = lpos + x;
-			int32_t v = data[px];
-			data[px] = (v < threshold) ? BLACK : WHITE;
-			int32_t err = v - data[px];
-			if (x < width - 1) {
-				data[px + 1] += (int32_t)(err * f8 + 0.5);
-				if (y < height - 1) {
-					data[px + width+1] += (int32_t)(err * f4 + 0.5);
-					if (y < height - 2) {
-						data[px + 2*width + 1] += (int32_t)(err * f2 + 0.5);
-					}
-				}
-				if (x < width - 2) {
-					data[px + 2] += (int32_t)(err * f4 + 0.5);
-					if (y < height - 1) {
-						data[px + width + 2] += (int32_t)(err * f2 + 0.5);
-						if (y < height - 2) {
-							data[px + 2 * width + 2] += (int32_t)(err * f1 + 0.5);
-						}
-					}
-				}
-			}
-			if (y < height - 1) { 
-				data[px + width] += (int32_t)(err * f8 + 0.5); 
-				if(y<height-2) { data[px + 2*width] += (int32_t)(err * f4 + 0.5); }
-			}
-			if (x>0) {
-				if (y < height - 1) {
-					data[px + width - 1] += (int32_t)(err * f4 + 0.5);
-					if (y < height - 2) { data[px + 2*width - 1] += (int32_t)(err * f2 + 0.5); }
-				}
-				if (x > 1) {
-					if (y < height - 1) {
-						data[px + width - 2] += (int32_t)(err * f2 + 0.5);
-						if (y < height - 2) { data[px + 2 * width - 2] += (int32_t)(err * f1 + 0.5); }
-					}
+bool MLGray::Jarvis(int32_t threshold) {
+	return ErrorDiffusion<JarvisKernel>(threshold);
+}
 
-				}
-			}
+bool MLGray::Stucki(int32_t threshold) {
+	return ErrorDiffusion<StuckiKernel>(threshold);
+}
 
-		}
-	}
-	delete[] tmp;
-	return true;
+bool MLGray::Burkes(int32_t threshold) {
+	return ErrorDiffusion<BurkesKernel>(threshold);
 }
 
+bool MLGray::SierraLite(int32_t threshold) {
+	return ErrorDiffusion<SierraLiteKernel>(threshold);
+}
 
-bool MLGray::FloydSteinberg(int32_t threshold) {
-	if ((height <= 1) || (width <= 1)) { return false; }
-	const double f7 = 0.4375; // 7/16
-	const double f5 = 0.3125;
-	const double f3 = 0.1875;
-	const double f1 = 0.0625;
-	const double f8 = f5 + f3;
-	int lpos;
-	int px;
-	// Assumes a ghost-row at top and propagates the errors of this row down.
-	int32_t* tmp = new int32_t[width];
-	memcpy(tmp, data, width * sizeof(int32_t));
-	for (int x = 0; x < width - 1; x++) {
-		int32_t v = tmp[x];
-		int32_t err = (v < threshold) ? v : WHITE - v;
-		data[x + 1] += (int32_t)(err * f7 + 0.5);
-		data[x] += (int32_t)(err * f5 + 0.5);
-	}
-	for (int y = 0; y < height - 1; y++) {
-		lpos = line(y);
-		int32_t v = data[lpos];
-		data[lpos] = (v < threshold) ? BLACK : WHITE;
-		int32_t err = v - data[lpos];
-		data[lpos + 1] += (int32_t)(err * f7 +0.5);
-		data[lpos + width] += (int32_t)(err * f8 + 0.5);  // No bug. Compensates for left-border effects
-		data[lpos + width + 1] += (int32_t)(err * f1 + 0.5);
-		for (int x = 1; x < width - 1; x++) {
-			px = lpos + x;
-			int32_t v = data[px];
-			data[px] = (v < threshold) ? BLACK : WHITE;
-			int32_t err = v - data[px];
-			data[px + 1] += (int32_t)(err * f7 + 0.5); 
-			data[px + width-1] += (int32_t)(err * f3 + 0.5);
-			data[px + width] += (int32_t)(err * f5 + 0.5); 
-			data[px + width + 1] += (int32_t)(err * f1 + 0.5); 
-		}
-		px = lpos + width - 1;
-		v = data[px];
-		data[px] = (v < threshold) ? BLACK : WHITE;
-		err = v - data[px];
-		data[px + width - 1] += (int32_t)(err * f3 + 0.5);
-		data[px + width] += (int32_t)(err * f8 + 0.5);  // No Bug. Compensates for rigth border effects
-	}
-	lpos = line(height - 1);
-	for (int x = 0; x < width - 1;x++) {
-		px = lpos + x;
-		int32_t v = data[px];
-		data[px] = (v < threshold) ? BLACK : WHITE;
-		int32_t err = v - data[px];
-		data[px + 1] += (int32_t)(err * f7 + 0.5);
-	}
-	delete[]tmp;
-	return true;
+bool MLGray::Atkinson(int32_t threshold) {
+	return ErrorDiffusion<AtkinsonKernel>(threshold);
 }
 
-int MLGray::OptOstromoukhov(int from,int to) {
-	return OptHalftone(from, to, OSTROMOUKHOV);
+int MLGray::OptOstromoukhov(int from, int to, int proxy, bool validate, bool l2) {
+	return OptHalftone(from, to, OSTROMOUKHOV, proxy, validate, l2);
 }
 
-int MLGray::OptJarvis(int from, int to) {
-	return OptHalftone(from, to,JARVIS);
+int MLGray::OptJarvis(int from, int to, int proxy, bool validate, bool l2) {
+	return OptHalftone(from, to, JARVIS, proxy, validate, l2);
 }
 
-int MLGray::OptStucki(int from, int to) {
-	return OptHalftone(from, to,STUCKI);
+int MLGray::OptStucki(int from, int to, int proxy, bool validate, bool l2) {
+	return OptHalftone(from, to, STUCKI, proxy, validate, l2);
 }
 
 
 
-int MLGray::OptFloydSteinberg(int from, int to) {
-	return OptHalftone(from, to, FLOYDSTEINBERG);
+int MLGray::OptFloydSteinberg(int from, int to, int proxy, bool validate, bool l2) {
+	return OptHalftone(from, to, FLOYDSTEINBERG, proxy, validate, l2);
 }
 
-int MLGray::OptHalftone(int from, int to,const int halftoneId) {
-	if ((halftoneId != FLOYDSTEINBERG) && (halftoneId != OSTROMOUKHOV) && (halftoneId != JARVIS)&&(halftoneId!=STUCKI)) { return -1; }
+bool MLGray::Halftone(int32_t threshold, const int halftoneId) {
+	if (halftoneId == FLOYDSTEINBERG) { return FloydSteinberg(threshold); }
+	if (halftoneId == OSTROMOUKHOV) { return Ostromoukhov(threshold); }
+	if (halftoneId == JARVIS) { return Jarvis(threshold); }
+	if (halftoneId == STUCKI) { return Stucki(threshold); }
+	return false;
+}
+
+int MLGray::SearchThreshold(int from, int to, int step, const int halftoneId, double& bestDist, int norm) {
 	int32_t sz = width * height;
-	double* G = new double[sz];
-	double* oG = new double[sz];
-	Gauss77FilterDbl(G);
-	MLGray ot = MLGray(width, height, data);
+	Arena::Scratch<float> G(sz);
+	BlurScore::Gauss77(data, width, height, stride, G);
+	MLGray ot = Buffer();
 	double bestVal = 1.0e20;
-	int bestThres = 0;
-	for (int thres = from; thres <= to; thres += 4) {
-		memcpy(ot.data, data, sz * sizeof(int32_t));
-		if (halftoneId == FLOYDSTEINBERG) { ot.FloydSteinberg(thres); }
-		if (halftoneId == OSTROMOUKHOV) { ot.Ostromoukhov(thres); }
-		if (halftoneId == JARVIS) { ot.Jarvis(thres); }
-		if (halftoneId == STUCKI) { ot.Stucki(thres); }
-		ot.Gauss77FilterDbl(oG);
-		int64_t dist = 0;
-		double diff = L1Distance(G,oG,sz);
+	int bestThres = from;
+	for (int thres = from; thres <= to; thres += step) {
+		CopyTo(ot);
+		ot.Halftone(thres, halftoneId);
+		double diff = BlurScore::Distance(ot.data, width, height, ot.stride, G, norm);
 		if (diff < bestVal) {
 			bestVal = diff;
 			bestThres = thres;
 		}
-		else {
-			if (dist > 1.5 * bestVal) { break; }
-		}
 	}
-	int l = bestThres - 3;
-	int h = bestThres + 3;
-	bestVal = 1.0e20;
-	for (int thres = l; thres <= h; thres++) {
-		memcpy(ot.data, data, sz * sizeof(int32_t));
-		if (halftoneId == FLOYDSTEINBERG) { ot.FloydSteinberg(thres); }
-		if (halftoneId == OSTROMOUKHOV) { ot.Ostromoukhov(thres); }
-		if (halftoneId == JARVIS) { ot.Jarvis(thres); }
-		if (halftoneId == STUCKI) { ot.Stucki(thres); }
-		ot.Gauss77FilterDbl(oG);
-		double diff = L1Distance(G,oG,sz);
-		if (diff < bestVal) {
-			bestVal = diff;
-			bestThres = thres;
+	if (step > 1) {
+		int l = bestThres - (step - 1);
+		int h = bestThres + (step - 1);
+		for (int thres = l; thres <= h; thres++) {
+			if ((thres - from) % step == 0) { continue; } // Already done in the coarse search
+			CopyTo(ot);
+			ot.Halftone(thres, halftoneId);
+			double diff = BlurScore::Distance(ot.data, width, height, ot.stride, G, norm);
+			if (diff < bestVal) {
+				bestVal = diff;
+				bestThres = thres;
+			}
 		}
 	}
-	double bestDist = bestVal / sz;
-	if (halftoneId == FLOYDSTEINBERG) {
-		std::cout << "OptFloydSteinberg: BEST-Threshold = " << bestThres << ", bestDist = " << bestDist << std::endl;
-		ot.FloydSteinberg(bestThres);
-	}
-	if (halftoneId == OSTROMOUKHOV) { 
-		std::cout << "OptOstromoukhov: BEST-Threshold = " << bestThres << ", bestDist = " << bestDist << std::endl;
-		ot.Ostromoukhov(bestThres);
+	bestDist = bestVal / sz;
+	return bestThres;
+}
+
+bool MLGray::Downscale(MLGray& proxy, int factor) {
+	if ((height <= 0) || (width <= 0) || (factor < 1)) { return false; }
+	if (!Materialize()) { return false; }
+	int w = width / factor;
+	int h = height / factor;
+	if ((w <= 0) || (h <= 0)) { return false; }
+	proxy.CreateImage(w, h);
+	const int32_t n = factor * factor;
+	for (int y = 0; y < h; y++) {
+		int32_t* p = proxy.data + proxy.line(y);
+		for (int x = 0; x < w; x++) { p[x] = 0; }
+		for (int dy = 0; dy < factor; dy++) {
+			const int32_t* d = data + line(y * factor + dy);
+			for (int x = 0; x < w; x++) {
+				for (int dx = 0; dx < factor; dx++) { p[x] += d[x * factor + dx]; }
+			}
+		}
+		for (int x = 0; x < w; x++) { p[x] = (p[x] + n / 2) / n; }
 	}
-	if (halftoneId == JARVIS) { 
-		std::cout << "OptJarvis: BEST-Threshold = " << bestThres << ", bestDist = " << bestDist << std::endl;
-		ot.Jarvis(bestThres);
+	return true;
+}
+
+int MLGray::OptHalftone(int from, int to, const int halftoneId, int proxy, bool validate, bool l2) {
+	if ((halftoneId != FLOYDSTEINBERG) && (halftoneId != OSTROMOUKHOV) && (halftoneId != JARVIS)&&(halftoneId!=STUCKI)) { return -1; }
+	if ((height <= 1) || (width <= 1)) { return -1; }
+	if (!Materialize()) { return -1; }
+	const char* names[] = { "OptFloydSteinberg", "OptOstromoukhov", "OptJarvis", "OptStucki" };
+	const char* name = names[halftoneId];
+	const int norm = (l2) ? BlurScore::L2 : BlurScore::L1;
+	double bestDist;
+	int bestThres;
+	MLGray p;
+	// The progress goes to cerr, stdout carries the completion records of the server.
+	// The proxy must be large enough for the 7x7 Gauss filter
+	if ((proxy > 1) && Downscale(p, proxy) && (p.width >= 8) && (p.height >= 8)) {
+		double proxyDist;
+		int proxyThres = p.SearchThreshold(from, to, 4, halftoneId, proxyDist, norm);
+		bestThres = SearchThreshold(proxyThres - 3, proxyThres + 3, 1, halftoneId, bestDist, norm);
+		std::cerr << name << ": Proxy 1/" << proxy << " Threshold = " << proxyThres << ", full-res refined = " << bestThres
+			<< ", shift = " << bestThres - proxyThres << std::endl;
+		if (validate) {
+			double fullDist;
+			int fullThres = SearchThreshold(from, to, 4, halftoneId, fullDist, norm);
+			std::cerr << name << ": Validate full-res Threshold = " << fullThres << ", bestDist = " << fullDist
+				<< ". Proxy error: Threshold " << bestThres - fullThres << ", Dist " << (bestDist - fullDist) / fullDist * 100.0 << "%" << std::endl;
+		}
 	}
-	if (halftoneId == STUCKI) { 
-		std::cout << "OptStucki: BEST-Threshold = " << bestThres << ", bestDist = " << bestDist << std::endl;
-		ot.Jarvis(bestThres);
+	else {
+		bestThres = SearchThreshold(from, to, 4, halftoneId, bestDist, norm);
 	}
-	int64_t dt = 0;
-	memcpy(data, ot.data, sz * sizeof(int32_t));
+	std::cerr << name << ": BEST-Threshold = " << bestThres << ", bestDist = " << bestDist << std::endl;
+	Halftone(bestThres, halftoneId);
 	return bestThres;
 }
 
 bool MLGray::Ostromoukhov(int32_t threshold) {
 	if ((height <= 1) || (width <= 1)) { return false; }
+	if (!Materialize()) { return false; }
 	int lpos;
 	int px;
 	double f0;
 	double f1;
 	double f2;
 	// Assumes a ghost-row at top and propagates the errors of this row down.
-	int32_t* tmp = new int32_t[width];
+	Arena::Scratch<int32_t> tmp(width);
 	memcpy(tmp, data, width * sizeof(int32_t));
 	for (int x = 0; x < width - 1; x++) {
 		int32_t v = clamp(tmp[x]);
@@ -537,7 +698,7 @@ bool MLGray::Ostromoukhov(int32_t threshold) {
 		f1 = (double)OstromC[v+1] / OstromC[v + 3];
 		f2 = (double)OstromC[v + 2] / OstromC[v + 3];
 		data[lpos + 1] += (int32_t)(err * f0 + 0.5);
-		data[lpos + width] += (int32_t)(err * (f2+f1) + 0.5); // Compensate left border effects
+		data[lpos + stride] += (int32_t)(err * (f2+f1) + 0.5); // Compensate left border effects
 		for (int x = 1; x < width - 1; x++) {
 			px = lpos + x;
 			int32_t v = clamp(data[px]);
@@ -548,8 +709,8 @@ bool MLGray::Ostromoukhov(int32_t threshold) {
 			f1 = (double)OstromC[v + 1] / OstromC[v + 3];
 			f2 = (double)OstromC[v + 2] / OstromC[v + 3];
 			data[px + 1] += (int32_t)(err * f0 + 0.5);
-			data[px + width - 1] += (int32_t)(err * f1 + 0.5);
-			data[px + width] += (int32_t)(err * f2 + 0.5);
+			data[px + stride - 1] += (int32_t)(err * f1 + 0.5);
+			data[px + stride] += (int32_t)(err * f2 + 0.5);
 		}
 		px = lpos + width - 1;
 		v = clamp(data[px]);
@@ -558,8 +719,8 @@ bool MLGray::Ostromoukhov(int32_t threshold) {
 		v *= 4;
 		f1 = (double)OstromC[v + 1] / OstromC[v + 3];
 		f2 = (double)OstromC[v + 2] / OstromC[v + 3];
-		data[px + width - 1] += (int32_t)(err * f1 + 0.5);
-		data[px + width] += (int32_t)(err * f2 + 0.5);
+		data[px + stride - 1] += (int32_t)(err * f1 + 0.5);
+		data[px + stride] += (int32_t)(err * f2 + 0.5);
 	}
 	lpos = line(height - 1);
 	for (int x = 0; x < width - 1; x++) {
@@ -571,218 +732,115 @@ bool MLGray::Ostromoukhov(int32_t threshold) {
 		f0 = (double)OstromC[v] / OstromC[v + 3];
 		data[px + 1] += (int32_t)(err * f0 + 0.5);
 	}
-	delete[] tmp;
 	return true;
 }
 
 bool MLGray::LaplaceSharpen(double factor) {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::LAPLACE_SHARPEN, factor); }
 
-	MLGray t = MLGray(width,height,data);
+	MLGray t = Buffer();
+	CopyBorder(t.data);
 	for (int y = 1; y < height - 1; y++) {
 		int lpos = line(y);
 		for (int x = 1; x < width - 1; x++) {
 			int px = lpos + x;
-			int32_t lap33=t.Conv33(px,Laplace);
-			data[px] += (int32_t)(factor*lap33 + 0.5);
+			int32_t lap33=Conv33(px,Laplace);
+			t.data[px] = data[px] + (int32_t)(factor*lap33 + 0.5);
 		}
 	}
+	Replace(t);
 	return true;
 }
 
 bool MLGray::Gauss55Filter() {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::GAUSS5); }
+	if (IsView()) { return Detached([](MLGray& t) { return t.Gauss55Filter(); }); }
 
-	int sz = width * height;
-	int32_t* td = new int32_t[sz];
-	memcpy(td, data, sz * sizeof(int32_t));
+	// The border is replicated. The horizontal pass writes to t, the vertical pass back to data.
+	MLGray t = Buffer();
+	FillBorder(REPLICATE);
 	for (int y = 0; y < height; y++) {
-		int lpos = line(y);
-		int px = lpos;
-		data[px] = 11 * td[px] + 4 * td[px + 1] + td[px + 2];
-		px += 1;
-		data[px] = 5 * td[px - 1] + 6 * td[px] + 4 * td[px + 1] + td[px + 2];
-		px = lpos + width - 2;
-		data[px] = td[px - 2] + 4 * td[px - 1] + 6 * td[px] + 5 * td[px + 1];
-		px++;
-		data[px] = td[px - 2] + 4 * td[px - 1] + 11 * td[px];
-
-		for (int x = 2; x < width - 2; x++) {
-			px = lpos + x;
-			data[px] += td[px - 2] + 4 * td[px - 1] + 6 * td[px] + 4 * td[px + 1] + td[px + 2];
+		const int32_t* s = data + line(y);
+		int32_t* d = t.data + line(y);
+		for (int x = 0; x < width; x++) {
+			d[x] = s[x - 2] + 4 * s[x - 1] + 6 * s[x] + 4 * s[x + 1] + s[x + 2];
 		}
 	}
-	memcpy(td, data, sz * sizeof(int32_t));
-	int w1 = width;
-	int w2 = w1+ width;
-	int w_1 = -width;
-	int w_2 = w_1 - width;
-	for (int x = 0; x < width; x++) {
-		int py = x;
-		data[py] = 11 * td[py] + 4 * td[py + w1] + td[py + w2];
-		data[py] /= 256;
-		py += width;
-		data[py] = 5 * td[py + w_1] + 6 * td[py] + 4 * td[py + w1] + td[py + w2];
-		data[py] /= 256;
-		py = x + width * (height - 2);
-		data[py] = td[py + w_2] + 4 * td[py + w_1] + 6 * td[py] + 5 * td[py + w1];
-		data[py] /= 256;
-		py += width;
-		data[py] = td[py + w_2] + 4 * td[py + w_1] + 11 * td[py];
-		for (int y = 2; y < height - 2; y++) {
-			py = x + y * width;
-			data[py] = td[py + w_2] + 4 * td[py + w_1] + 6 * td[py] + 4 * td[py + w1] + td[py + w2];
-			data[py] /= 256;
+	t.FillBorder(REPLICATE);
+	const int w1 = stride;
+	const int w2 = w1 + stride;
+	for (int y = 0; y < height; y++) {
+		const int32_t* s = t.data + line(y);
+		int32_t* d = data + line(y);
+		for (int x = 0; x < width; x++) {
+			d[x] = (s[x - w2] + 4 * s[x - w1] + 6 * s[x] + 4 * s[x + w1] + s[x + w2]) / 256;
 		}
 	}
-	delete[] td;
 	return true;
 }
 
-double MLGray::L1Distance(double* f1, double* f2, int sz) {
-	double d1 = 0.0;
-	for (int n = 0; n < sz; n++) {
-		d1 += std::abs(f1[n]-f2[n]);
-	}
-	return d1;
-}
-
-double MLGray::L2Distance(double* f1, double* f2, int sz) {
-	double d2 = 0.0;
-	for (int n = 0; n < sz; n++) {
-		double d = f1[n] - f2[n];
-		d2 += d*d;
-	}
-	return d2;
-}
-
 bool MLGray::Gauss77FilterDbl(double *f) {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (!Materialize()) { return false; }
+	if (IsView()) { return Detached([f](MLGray& t) { return t.Gauss77FilterDbl(f); }); }
 
-	int sz = width*height;
-	double* fx = new double[sz];
-	for (int n = 0; n < sz; n++) {
-		f[n] = 0.0;
-		fx[n] = 0.0;
-	}
+	// fx has the same layout as data. Its ghost lines replicate the first and last line.
+	Arena::Scratch<double> fx(PAD + (size_t)(height + 2 * GHOST) * stride);
+	double* fx0 = fx + PAD + GHOST * stride;
+	FillBorder(REPLICATE);
 	for (int y = 0; y < height; y++) {
-		int lpos = line(y);
-		int px = lpos;
-		fx[px] = 42.0*data[px]+15.0*data[px+1]+6.0*data[px+2]+data[px+3];
-		px += 1;
-		fx[px] = 22.0*data[px-1]+20.0*data[px]+15.0*data[px+1]+6.0*data[px+2]+data[px+3];
-		px += 1;
-		fx[px] = 7.0*data[px-2]+15.0*data[px-1]+20.0*data[px]+15.0*data[px+1]+6.0*data[px+2]+data[px+3];
-		px = lpos+width-3;
-		fx[px] = data[px-3]+6.0*data[px-2]+15.0*data[px-1]+20.0*data[px]+15.0*data[px+1]+7.0*data[px+2];
-		px++;
-		fx[px] = data[px-3]+6.0*data[px-2]+15.0*data[px-1]+20.0*data[px]+22.0*data[px+1];
-		px++;
-		fx[px] = data[px-3]+6.0*data[px-2]+15.0*data[px-1]+42.0*data[px];
-
-		for (int x = 3; x < width-3; x++) {
-			px = lpos+x;
-			fx[px] = data[px-3]+6.0*data[px-2]+15.0*data[px-1]+20.0*data[px]+15.0*data[px+1]+6.0*data[px+2]+data[px+3];
+		const int32_t* s = data + line(y);
+		double* d = fx0 + line(y);
+		for (int x = 0; x < width; x++) {
+			d[x] = s[x-3]+6.0*s[x-2]+15.0*s[x-1]+20.0*s[x]+15.0*s[x+1]+6.0*s[x+2]+s[x+3];
 		}
 	}
-	int w1 = width;
-	int w2 = w1+width;
-	int w3 = w2+width;
-	int w_1 = -width;
-	int w_2 = w_1-width;
-	int w_3 = w_2-width;
-	for (int x = 0; x < width; x++) {
-		int py = x;
-	    f[py] = 42.0*fx[py]+15.0*fx[py+w1]+6.0*fx[py+w2]+fx[py+w3];
-		f[py] /= 4096.0;
-		py += width;
-		f[py] = 22.0*fx[py+w_1]+20.0*fx[py]+15.0*fx[py+w1]+6.0*fx[py+w2]+fx[py+w3];
-		f[py] /= 4096.0;
-		py += width;
-		f[py] = 7.0*fx[py+w_2]+15.0*fx[py+w_1]+20.0*fx[py]+15.0*fx[py+w1]+6.0*fx[py+w2]+fx[py+w3];
-		f[py] /= 4096.0;
-		py = x+width*(height-3);
-		f[py] = fx[py+w_3]+6.0*fx[py+w_2]+15.0*fx[py+w_1]+20.0*fx[py]+15.0*fx[py+w1]+7.0*fx[py+w1];
-		f[py] /= 4096.0;
-		py += width;
-		f[py] = fx[py+w_3]+6.0*fx[py+w_2]+15.0*fx[py+w_1]+20.0*fx[py]+22.0*fx[py+w1];
-		f[py] /= 4096.0;
-		py += width;
-		f[py] = fx[py+w_3]+6.0*fx[py+w_2]+15.0*fx[py+w_1]+42.0*fx[py];
-		f[py] /= 4096.0;
-
-		for (int y = 3; y < height-3; y++) {
-			py = x+y*width;
-			f[py] = fx[py+w_3]+6.0*fx[py+w_2]+15.0*fx[py+w_1]+20.0*fx[py]+15.0*fx[py+w1]+6.0*fx[py+w2]+fx[py+w3];
-			f[py] /= 4096.0;
+	for (int k = 1; k <= 3; k++) {
+		memcpy(fx0 + line(-k), fx0, width * sizeof(double));
+		memcpy(fx0 + line(height - 1 + k), fx0 + line(height - 1), width * sizeof(double));
+	}
+	const int w1 = stride;
+	const int w2 = w1 + stride;
+	const int w3 = w2 + stride;
+	for (int y = 0; y < height; y++) {
+		const double* s = fx0 + line(y);
+		double* d = f + (size_t)y * width;
+		for (int x = 0; x < width; x++) {
+			d[x] = (s[x-w3]+6.0*s[x-w2]+15.0*s[x-w1]+20.0*s[x]+15.0*s[x+w1]+6.0*s[x+w2]+s[x+w3]) / 4096.0;
 		}
 	}
-	delete[] fx;
 	return true;
 }
 
 
 bool MLGray::Gauss77Filter() {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::GAUSS7); }
+	if (IsView()) { return Detached([](MLGray& t) { return t.Gauss77Filter(); }); }
 
-	int sz = width * height;
-	int32_t* td = new int32_t[sz];
-	memcpy(td, data, sz * sizeof(int32_t));
+	// The border is replicated. The horizontal pass writes to t, the vertical pass back to data.
+	MLGray t = Buffer();
+	FillBorder(REPLICATE);
 	for (int y = 0; y < height; y++) {
-		int lpos = line(y);
-		int px = lpos;
-		data[px] = 42 * td[px] + 15 * td[px + 1] + 6*td[px + 2]+td[px+3];
-		px += 1;
-		data[px] = 22 * td[px-1] + 20 * td[px] + 15 * td[px + 1] + 6*td[px + 2]+ td[px + 3];
-		px += 1;
-		data[px] = 7*td[px-2]+15 * td[px-1] + 20 * td[px] + 15 * td[px + 1] + 6 * td[px + 2] + td[px + 3];
-		px = lpos + width-3;
-		data[px] = td[px-3]+6*td[px-2] + 15 * td[px-1] + 20 * td[px] + 15 * td[px + 1]+ 7 * td[px + 2];
-		px++;
-		data[px] = td[px-3] + 6 * td[px-2] + 15 * td[px-1] + 20 * td[px] + 22 * td[px + 1];
-		px++;
-		data[px] = td[px-3] + 6 * td[px-2] + 15 * td[px-1] + 42 * td[px];
-
-		for (int x = 3; x < width-3; x++) {
-			px = lpos + x;
-			data[px] = td[px-3]+6*td[px-2] + 15 * td[px-1] + 20 * td[px] + 15 * td[px + 1] + 6*td[px + 2]+td[px+3];
+		const int32_t* s = data + line(y);
+		int32_t* d = t.data + line(y);
+		for (int x = 0; x < width; x++) {
+			d[x] = s[x - 3] + 6 * s[x - 2] + 15 * s[x - 1] + 20 * s[x] + 15 * s[x + 1] + 6 * s[x + 2] + s[x + 3];
 		}
 	}
-	memcpy(td, data, sz * sizeof(int32_t));
-	int w1 = width;
-	int w2 = w1 + width;
-	int w3 = w2 + width;
-	int w_1 = -width;
-	int w_2 = w_1 - width;
-	int w_3 = w_2 - width;
-	for (int x = 0; x < width; x++) {
-		int py = x;
-		data[py] = 42 * td[py] + 15 * td[py + w1] + 6*td[py + w2]+td[py+w3];
-		data[py] /= 4096;
-		py += width;
-		data[py] = 22 * td[py + w_1] + 20 * td[py] + 15 * td[py + w1] + 6*td[py + w2]+td[py+w3];
-		data[py] /= 4096;
-		py += width;
-		data[py] = 7 * td[py + w_2]+15 * td[py + w_1] + 20 * td[py] + 15 * td[py + w1] + 6 * td[py + w2] + td[py + w3];
-		data[py] /= 4096;
-
-		py = x + width * (height - 3);
-		data[py] = td[py + w_3] + 6*td[py + w_2] + 15 * td[py + w_1] + 20 * td[py] + 15 * td[py + w1]+7 * td[py + w1];
-		data[py] /= 4096;
-		py += width;
-		data[py] = td[py + w_3] + 6 * td[py + w_2] + 15 * td[py + w_1] + 20 * td[py] + 22 * td[py + w1];
-		data[py] /= 4096;
-		py += width;
-		data[py] = td[py + w_3] + 6 * td[py + w_2] + 15 * td[py + w_1] + 42 * td[py];
-		data[py] /= 4096;
-
-		for (int y = 3; y < height - 3; y++) {
-			py = x + y * width;
-			data[py] = td[py + w_3] + 6 * td[py + w_2] + 15 * td[py + w_1] + 20 * td[py] + 15 * td[py + w1] + 6 * td[py + w2] + td[py + w3];
-			data[py] /= 4096;
+	t.FillBorder(REPLICATE);
+	const int w1 = stride;
+	const int w2 = w1 + stride;
+	const int w3 = w2 + stride;
+	for (int y = 0; y < height; y++) {
+		const int32_t* s = t.data + line(y);
+		int32_t* d = data + line(y);
+		for (int x = 0; x < width; x++) {
+			d[x] = (s[x - w3] + 6 * s[x - w2] + 15 * s[x - w1] + 20 * s[x] + 15 * s[x + w1] + 6 * s[x + w2] + s[x + w3]) / 4096;
 		}
 	}
-	delete[] td;
 	return true;
 }
 
@@ -795,6 +853,7 @@ bool MLGray::Med5Laplace(double factor) {
 
 bool MLGray::Rescale(double offset,double factor) {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::RESCALE, offset, factor); }
 
 	for (int y = 1; y < height - 1; y++) {
 		int lpos = line(y);
@@ -809,108 +868,130 @@ bool MLGray::Rescale(double offset,double factor) {
 
 bool MLGray::KnuthEdge(double factor) {
 	if ((height <= 0) || (width <= 0)||(factor<0)||(factor>=1.0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::KNUTH_EDGE, factor); }
+	if (IsView()) { return Detached([factor](MLGray& t) { return t.KnuthEdge(factor); }); }
 	const double denom = 1.0 - factor;
-	MLGray t = MLGray(width, height, data);
+	MLGray t = Buffer();
+	CopyBorder(t.data);
+	FillBorder(ZERO);
 	for (int y = 0; y < height; y++) {
 		int lpos = line(y);
 		for (int x = 1; x < width - 1; x++) {
 			int px = lpos + x;
-			double mx = (double)t.Accumulate33(x,y) / 9.0;
+			double mx = (double)Accumulate33(px) / 9.0;
 			int32_t v = data[px];
-			data[px] = (int32_t)((v-factor*mx)/denom + 0.5);
+			t.data[px] = (int32_t)((v-factor*mx)/denom + 0.5);
 		}
 	}
+	Replace(t);
 	return true;
-	;
 }
 
 
 bool MLGray::MedianFilter9() {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::MEDIAN9); }
 
-	MLGray t = MLGray(width, height, data);
+	MLGray t = Buffer();
+	CopyBorder(t.data);
 	for (int y = 1; y < height - 1; y++) {
 		int lpos = line(y);
 		for (int x = 1; x < width - 1; x++) {
 			int px = lpos + x;
-			data[px] = t.MedianMsk9(px);
+			t.data[px] = MedianMsk9(px);
 		}
 	}
+	Replace(t);
 	return true;
 }
 
 bool MLGray::MedianFilter5() {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::MEDIAN5); }
 
-	MLGray t = MLGray(width, height, data);
-
+	MLGray t = Buffer();
+	CopyBorder(t.data);
 	for (int y = 1; y < height - 1; y++) {
 		int lpos = line(y);
 		for (int x = 1; x < width - 1; x++) {
 			int px = lpos + x;
-			data[px] = t.MedianMsk5(px);
+			t.data[px] = MedianMsk5(px);
 		}
 	}
+	Replace(t);
 	return true;
 }
 
 
 bool MLGray::GameOfLife(bool whiteAlife,int generations) {
 	if ((height <= 0) || (width <= 0)) { return false; }
-	cout << "GoL life = " << whiteAlife << ", generations = " << generations << endl;
-	int sz=width*height;
+	if ((graph == nullptr) && IsView()) {
+		return Detached([=](MLGray& t) { return t.GameOfLife(whiteAlife, generations); });
+	}
+	cerr << "GoL life = " << whiteAlife << ", generations = " << generations << endl;
+	if (graph != nullptr) {
+		for (int g = 0; g < generations; g++) { Defer(MLGraph::GAME_OF_LIFE, whiteAlife); }
+		return true;
+	}
 	const int32_t W2=2*WHITE;
 	const int32_t W3=3*WHITE;
 	const int32_t W8=8*WHITE;
-	MLGray t = MLGray(width, height);
+	MLGray t = Buffer();
 	int32_t life=(whiteAlife)?WHITE:BLACK;
 	int32_t dead=(whiteAlife)?BLACK:WHITE;
 	for (int g = 0; g < generations; g++) {
-		memcpy(t.data,data,sz*sizeof(int32_t));
+		FillBorder(ZERO);
 		for (int y = 0; y < height; y++) {
 			int lpos = line(y);
 			for (int x = 0; x < width; x++) {
 				int px = lpos + x;
 
-				int v = t.data[px];
-				int a = t.Accumulate8(x, y);
+				int v = data[px];
+				int a = Accumulate8(px);
 				if(whiteAlife) { a=W8-a;}
 				if (v == life) {
-					data[px] = ((a==W2)||(a==W3))?life:dead;
+					t.data[px] = ((a==W2)||(a==W3))?life:dead;
 				}
 				else {
-					data[px]=(a==W3)?life:dead;
+					t.data[px]=(a==W3)?life:dead;
 				}
 			}
 		}
+		Replace(t);
 	}
 	return true;
 }
   
 bool MLGray::SaltPepper(int32_t threshold) {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::SALT_PEPPER, threshold); }
+	if (IsView()) { return Detached([threshold](MLGray& t) { return t.SaltPepper(threshold); }); }
 	int32_t wthreshold = threshold*WHITE;
 	int32_t bthreshold = (9 - threshold) * WHITE;
-	MLGray t = MLGray(width, height, data);
+	MLGray t = Buffer();
+	FillBorder(ZERO);
 	for (int y = 0; y < height; y++) {
 		int lpos = line(y);
 		for (int x = 0; x < width; x++) {
 			int px = lpos + x;
 			int v = data[px];
-			int a = t.Accumulate33(x,y);
+			int a = Accumulate33(px);
+			t.data[px] = v;
 			if (v == WHITE) {
-				if (a <= wthreshold) { data [px]= BLACK; }
+				if (a <= wthreshold) { t.data[px] = BLACK; }
 			}
 			else {
-				if (a >= bthreshold) { data[px] = WHITE; }
+				if (a >= bthreshold) { t.data[px] = WHITE; }
 			}
 		}
 	}
+	Replace(t);
 	return true;
 }
 
 bool MLGray::Invert() {
 	if ((height <= 0) || (width <= 0)) { return false; }
+	if (graph != nullptr) { return Defer(MLGraph::INVERT); }
 	for (int y = 0; y < height; y++) {
 		int lpos = line(y);
 		for (int x = 0; x < width; x++) {
@@ -924,100 +1005,134 @@ bool MLGray::Invert() {
 
 bool MLGray::Majority() {
 	if ((height <= 0) || (width <= 0)) { return false; }
-	MLGray t = MLGray(width, height, data);
+	if (graph != nullptr) { return Defer(MLGraph::MAJORITY); }
+	if (IsView()) { return Detached([](MLGray& t) { return t.Majority(); }); }
+	MLGray t = Buffer();
 	int32_t W5=5*WHITE;
+	FillBorder(ZERO);
 	for (int y = 0; y < height; y++) {
 		int lpos = line(y);
 		for (int x = 0; x < width; x++) {
 			int px = lpos + x;
-			data[px] = (t.Accumulate33(x,y)>=W5)?WHITE:BLACK;
+			t.data[px] = (Accumulate33(px)>=W5)?WHITE:BLACK;
 		}
 	}
+	Replace(t);
 	return true;
 }
 
 
 
-bool MLGray::Bayer44() {
+template<int K>
+bool MLGray::OrderedDither(int32_t range, uint32_t seed) {
 	if ((height <= 0) || (width <= 0)) { return false; }
-
-	for (int y = 1; y < height - 1; y++) {
-		int lpos = line(y);
-		int my = (y % 4)*4;
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			int mx = my + (x % 4);
-			int32_t v = data[px];
-			data[px] = (v>=BayerMsk44[mx])?WHITE:BLACK;
+	if (!Materialize()) { return false; }
+	static constexpr BayerMatrix<K> msk;
+	const int N = BayerMatrix<K>::N;
+	// The N lines of the mask tiled across the width of the image
+	Arena::Scratch<int32_t> tiled((size_t)N * width);
+	for (int my = 0; my < N; my++) {
+		int32_t* t = tiled + (size_t)my * width;
+		for (int x = 0; x < width; x++) {
+			t[x] = msk.t[my * N + (x & (N - 1))];
 		}
 	}
+	const int32_t white = WHITE;
+	const int32_t black = BLACK;
+	Parallel::For(0, height, [&](int from, int to) {
+		for (int y = from; y < to; y++) {
+			int32_t* d = data + line(y);
+			const int32_t* t = tiled + (size_t)(y & (N - 1)) * width;
+			if (range <= 0) {
+				for (int x = 0; x < width; x++) {
+					d[x] = (d[x] >= t[x]) ? white : black;
+				}
+				continue;
+			}
+			uint32_t key = LineKey(seed, y);
+			for (int x = 0; x < width; x++) {
+				int32_t v = d[x] + UniformInt(PixelRandom(key, x), -range, range);
+				d[x] = (v >= t[x]) ? white : black;
+			}
+		}
+	});
 	return true;
 }
 
+bool MLGray::Bayer44() {
+	return OrderedDither<2>();
+}
+
 bool MLGray::Bayer88() {
-	if ((height <= 0) || (width <= 0)) { return false; }
+	return OrderedDither<3>();
+}
 
-	for (int y = 1; y < height - 1; y++) {
-		int lpos = line(y);
-		int my = (y % 8) * 8;
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			int mx = my + (x % 8);
-			int32_t v = data[px];
-			data[px] = (v >= BayerMsk88[mx]) ? WHITE : BLACK;
-		}
+bool MLGray::Bayer(int size) {
+	switch (size) {
+	case 2: return OrderedDither<1>();
+	case 4: return OrderedDither<2>();
+	case 8: return OrderedDither<3>();
+	case 16: return OrderedDither<4>();
+	case 32: return OrderedDither<5>();
+	case 64: return OrderedDither<6>();
 	}
-	return true;
+	return false;
 }
 
-bool MLGray::BayerRnd88(int32_t range) {
-	if ((height <= 0) || (width <= 0)||(range<=0)) { return false; }
-	std::mt19937 rnd(47114713); // seed the generator
-	std::uniform_int_distribution<> unif(-range,range); // define the range
+bool MLGray::BayerRnd88(int32_t range, uint32_t seed) {
+	if (range <= 0) { return false; }
+	return OrderedDither<3>(range, seed);
+}
 
-	for (int y = 1; y < height - 1; y++) {
-		int lpos = line(y);
-		int my = (y % 8) * 8;
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			int mx = my + (x % 8);
-			int32_t v = data[px]+unif(rnd);
-			data[px] = (v >= BayerMsk88[mx]) ? WHITE : BLACK;
+bool MLGray::BlueNoise() {
+	if ((height <= 0) || (width <= 0)) { return false; }
+	if (!Materialize()) { return false; }
+	const int32_t* msk = BlueNoiseMask();
+	Parallel::For(0, height, [&](int from, int to) {
+		for (int y = from; y < to; y++) {
+			int32_t* d = data + line(y);
+			const int32_t* m = msk + (y & (BlueNoiseSize - 1)) * BlueNoiseSize;
+			// The mask line is applied tile by tile. No modulo in the inner loop, it is vectorized by the compiler.
+			for (int xt = 0; xt < width; xt += BlueNoiseSize) {
+				int n = (width - xt < BlueNoiseSize) ? width - xt : BlueNoiseSize;
+				int32_t* dt = d + xt;
+				for (int x = 0; x < n; x++) {
+					dt[x] = (dt[x] >= m[x]) ? WHITE : BLACK;
+				}
+			}
 		}
-	}
+	});
 	return true;
 }
 
 bool MLGray::Threshold(int32_t threshold) {
 	if ((height <= 0) || (width <= 0)) { return false; }
-	for (int y = 1; y < height - 1; y++) {
-		int lpos = line(y);
-		int my = (y % 8) * 8;
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			int32_t v = data[px];
-			data[px] = (v >= threshold) ? WHITE : BLACK;
+	if (!Materialize()) { return false; }
+	for (int y = 0; y < height; y++) {
+		int32_t* d = data + line(y);
+		for (int x = 0; x < width; x++) {
+			d[x] = (d[x] >= threshold) ? WHITE : BLACK;
 		}
 	}
 	return true;
 
 }
 
-bool MLGray::Random() {
+bool MLGray::Random(uint32_t seed) {
 	if ((height <= 0) || (width <= 0)) { return false; }
-	std::mt19937 rnd(47114713); // seed the generator
-	std::uniform_int_distribution<> unif(BLACK,WHITE); 
-
-
-	for (int y = 1; y < height - 1; y++) {
-		int lpos = line(y);
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			int32_t r = unif(rnd);
-			int32_t v = data[px];
-			data[px] = (v >= r) ? WHITE : BLACK;
+	if (!Materialize()) { return false; }
+	const int32_t white = WHITE;
+	const int32_t black = BLACK;
+	Parallel::For(0, height, [&](int from, int to) {
+		for (int y = from; y < to; y++) {
+			int32_t* d = data + line(y);
+			uint32_t key = LineKey(seed, y);
+			for (int x = 0; x < width; x++) {
+				int32_t r = UniformInt(PixelRandom(key, x), black, white);
+				d[x] = (d[x] >= r) ? white : black;
+			}
 		}
-	}
+	});
 	return true;
 }
 
@@ -1029,68 +1144,83 @@ bool MLGray::Random() {
 
 bool MLGray::LaplaceFilter(int offset) {
 	if ((height <= 0) || (width <= 0)) { return false; }
-	MLGray t = MLGray(width, height,data);
+	if (!Materialize()) { return false; }
+	MLGray t = Buffer();
+	CopyBorder(t.data);
 	for (int y = 1; y < height - 1; y++) {
 		int lpos = line(y);
 		for (int x = 1; x < width - 1; x++) {
 			int px = lpos + x;
-			int px1 = px + width;
-			int px_1 = px - width;
 			int32_t lap33 = Conv33(px,Laplace);
-			data[px] = offset+lap33;
+			t.data[px] = offset+lap33;
 		}
 	}
-	return false;
+	Replace(t);
+	return true;
 }
 
-void MLGray::LinearGradient(bool blackToWhite) {
-	CreateImage(512,512);
-	for (int y = 0; y < height; y++) {
-		int lpos = line(y);
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			data[px] = (blackToWhite) ? x / 2 : WHITE - x / 2;
+void MLGray::LinearGradient(bool blackToWhite, int w, int h) {
+	if ((w <= 0) || (h <= 0)) { return; }
+	CreateImage(w, h);
+	Parallel::For(0, height, [&](int from, int to) {
+		for (int y = from; y < to; y++) {
+			int lpos = line(y);
+			for (int x = 0; x < width; x++) {
+				int px = lpos + x;
+				int32_t v = (int32_t)((long long)x * 256 / width);  // x/2 for the width 512
+				data[px] = (blackToWhite) ? v : WHITE - v;
+			}
 		}
-	}
+	});
 }
 
-void MLGray::RadialGradient(bool blackToWhite) {
-	CreateImage(512, 512);
-	const double xm = 255.5;
-	const double ym = 255.5;
+void MLGray::RadialGradient(bool blackToWhite, int w, int h) {
+	if ((w <= 0) || (h <= 0)) { return; }
+	CreateImage(w, h);
+	const double xm = (width - 1) / 2.0;
+	const double ym = (height - 1) / 2.0;
+	const double scale = 512.0 / max(width, height);
 
-	for (int y = 0; y < height; y++) {
-		int lpos = line(y);
-		for (int x = 1; x < width - 1; x++) {
-			int px = lpos + x;
-			double dy = y - ym;
-			double dx = x - xm;
-			double d = sqrt(dy * dy + dx * dx);
-			double v = (blackToWhite) ? d : WHITE - d;
-			data[px] = (int32_t)(v + 0.5);
+	Parallel::For(0, height, [&](int from, int to) {
+		for (int y = from; y < to; y++) {
+			int lpos = line(y);
+			for (int x = 0; x < width; x++) {
+				int px = lpos + x;
+				double dy = y - ym;
+				double dx = x - xm;
+				double d = sqrt(dy * dy + dx * dx) * scale;
+				double v = (blackToWhite) ? d : WHITE - d;
+				data[px] = (int32_t)(v + 0.5);
+			}
 		}
-	}
+	});
 }
 
 
 unsigned char* MLGray::ToStb() {
-	int sz = width * height;
-	unsigned char* img = new unsigned char[sz * RGB_Channels];
-	for (int n = 0,ni=0; n < sz; n++,ni+=RGB_Channels) {
-		unsigned char c = clamp(data[n]);
-		img[ni] = c;
-		img[ni + 1] = c;
-		img[ni + 2] = c;
-	}
+	unsigned char* img = new unsigned char[(size_t)width * height * RGB_Channels];
+	ToStb(img);
 	return img;
 }
 
-bool MLGray::SaveImage(string fileName, int quality) {
-	unsigned char* img = ToStb();
-	stbi_write_jpg(fileName.c_str(), width, height, RGB_Channels, img, quality);
-	delete[] img;
-	return true;
+void MLGray::ToStb(unsigned char* img) {
+	Materialize();
+	for (int y = 0, ni = 0; y < height; y++) {
+		const int32_t* d = data + line(y);
+		for (int x = 0; x < width; x++, ni += RGB_Channels) {
+			unsigned char c = clamp(d[x]);
+			img[ni] = c;
+			img[ni + 1] = c;
+			img[ni + 2] = c;
+		}
+	}
+}
 
+bool MLGray::SaveImage(string fileName, int quality) {
+	Materialize();
+	Trace::Scope s("Encode");
+	if (Trace::Enabled()) { s.Detail(fileName); }
+	return JpegWriter::WriteGray(fileName, data, width, height, stride, quality);
 }
 
 
@@ -11,7 +11,9 @@
 #include <cstdint>
 #include <string>
 #include "Calc.h"
+#include "MLSource.h"
 
+class MLGraph;
 
 using std::string;
 /**
@@ -34,6 +36,23 @@ using std::string;
 class MLGray
 {
 public:
+    /**
+    <summary>The content of the ghost border around the image. See FillBorder().</summary>
+    */
+    enum BorderMode {
+        REPLICATE,  // the border pixel is repeated: a a a | a b c
+        REFLECT,    // the image is mirrored at the border pixel: d c b | a b c d
+        ZERO        // BLACK: 0 0 0 | a b c
+    };
+    /**
+    <summary>The width of the ghost border in pixels. It covers the 7x7 Gauss filter and the diffusion kernels.</summary>
+    */
+    static const int GHOST = 4;
+    /**
+    <summary>The version of the library. Must be increased whenever an operation produces different pixels.
+    It is part of the key of the ResultCache.</summary>
+    */
+    static const int VERSION = 1;
 	/**
 	<summary> 
     Default Constructor.
@@ -53,13 +72,37 @@ public:
     Constructs an image with paramter width and height, allocates the data-array and copies the src-data.
     <param name="width">  width of image. </param>
     <param name="height">  height of image. </param>
-    <param name="srcdata"> The data of the original image </param>
+    <param name="srcdata"> The data of the original image. width*height pixels, stored line-wise without padding.</param>
     */
     MLGray(int width, int height, int32_t* srcdata);
+    /**
+    <summary>Takes over the data of other. other is empty afterwards.</summary>
+    */
+    MLGray(MLGray&& other) noexcept;
+    /**
+    <summary>Takes over the data of other. The previous data is released, other is empty afterwards.</summary>
+    */
+    MLGray& operator=(MLGray&& other) noexcept;
+    /**
+    <summary>Images are not copied implicitly. Use Clone() for a copy.</summary>
+    */
+    MLGray(const MLGray&) = delete;
+    MLGray& operator=(const MLGray&) = delete;
 	~MLGray();
     /**
+    <returns>A copy of the image with its own data. The copy of a view is an image. Pending lazy filters are applied
+    first, the copy is in lazy mode if this image is.</returns>
+    */
+    MLGray Clone();
+    /**
+    <summary>Exchanges the images. Only the pointers are swapped, no data is copied. The lazy mode is not exchanged,
+    each image keeps its mode and its pending operations. Materialize() before, if operations are pending.</summary>
+    */
+    void Swap(MLGray& other) noexcept;
+    /**
     <summary>
-    Creates an image with the given width and height and allocates the data-array. Previous allocated memory is deleted.
+    Creates an image with the given width and height and allocates the data-array. The previous data-array is reused if
+    it is large enough, otherwise it is returned to the Arena (see Arena.h).
     </summary>
     <param name="width">  width of image. </param>
     <param name="height">  height of image. </param>
@@ -67,18 +110,27 @@ public:
     */
     bool CreateImage(int width, int height);
     /**
-    <summary> A thin wrapper around the stbi_load() function. Loads the image from disc into an array 
+    <summary> A thin wrapper around the stbi_load_from_memory() function. Loads the image into an array
     of unsigned char. The the pixels are stored line-wise without any padding. In case of a gray-scale image (channels==1)
     one char per pixel. In case of RGB images (channel==3) as triples [r,g,b]. If you want to replace stbi_image() you
     have to return the data in the same format.
+    A file is memory mapped (see MappedFile) and decoded from the mapping. If it can not be mapped, it is read with
+    stbi_load(). A buffer is decoded directly.
+    With MLSource::SetScale() a baseline JPEG is decoded at reduced size by JpegReader. Other images are decoded at
+    full size and reduced afterwards. The data is freed with stbi_image_free() in both cases.
     </summary>
-    <param name="fileName"> Full Filename with ending. Example: "./image/Lena.jpg"
+    <param name="src"> Full Filename with ending or the encoded image. Example: "./image/Lena.jpg"
     <param name="width">  width of image. </param>
     <param name="height">  height of image. </param>
     <param name="channels">  channels == 1 for grayscale and 3 for RGB. stbi_image supports also ARGB with channels == 4</param>
     <returns>pointer to data if image can be loaded, nullptr if load failed</returns>
     */
-    unsigned char* LoadImage(string fileName, int& width, int& height, int& channels);
+    unsigned char* LoadImage(const MLSource& src, int& width, int& height, int& channels);
+    /**
+    <returns>The time in ms which the last LoadImage() of the calling thread took. The converters call LoadImage(),
+    so this is the decoding part of a conversion.</returns>
+    */
+    static double LastDecodeMs();
     /**
     <returns>width of image</returns>
     */
@@ -88,17 +140,67 @@ public:
     */
     int GetHeight() { return height; }
     /**
-    <returns>data-array aka pixel-values of image</returns>
+    <returns>data-array aka pixel-values of image. Pending lazy operations are executed first.
+    The lines are GetStride() elements apart. Each line starts at a 64-byte boundary.</returns>
+    */
+    int32_t *GetData() { Materialize(); return data; }
+    /**
+    <returns>The distance of two lines in the data-array in elements. It is at least width+2*GHOST.</returns>
+    */
+    int GetStride() { return stride; }
+    /**
+    <summary>Fills the ghost border of GHOST pixels around the image. Filters which read outside the image fill
+    it first, so their inner loops run without border checks over the whole image.
+    </summary>
+    <param name="mode">One of REPLICATE, REFLECT, ZERO</param>
+    */
+    void FillBorder(int mode = REPLICATE);
+    /**
+    <summary>Returns a view of the rectangle (x,y,w,h) of the image. The view shares the data with the image,
+    nothing is copied. All operations can be applied to the view. They change only the pixels inside the rectangle
+    and process it as if it were an image of its own. Views of disjoint rectangles can be processed in parallel.
+    The view must not outlive the image. Pending lazy operations of the image are executed first.
+    CreateImage() and the Color to Grayscale conversions detach the view from the image.
+    </summary>
+    <param name="x">left column of the rectangle</param>
+    <param name="y">top line of the rectangle</param>
+    <param name="w">width of the rectangle. It is clipped to the image</param>
+    <param name="h">height of the rectangle. It is clipped to the image</param>
+    <returns>The view. It is empty if the rectangle does not intersect the image.</returns>
+    */
+    MLGray View(int x, int y, int w, int h);
+    /**
+    <returns>true if the image is a view of another image. See View().</returns>
+    */
+    bool IsView() { return (frame == nullptr) && (data != nullptr); }
+    /**
+    <summary>Switches the lazy mode on or off. In lazy mode the preprocessing filters (Gauss, Laplace, Median, Edge,
+    Logistic, Rescale) and the postprocessing filters (SaltPepper, Majority, Invert, GameOfLife) are not executed 
+    immediately. They are recorded in an operation graph and executed as one fused pass over the image, when the
+    result is needed. Halftoning, GetData() and SaveImage() materialize the pending operations. 
+    Loading a new image discards them. The result is the same as in the default immediate mode.
+    Switching the lazy mode off executes pending operations.
+    </summary>
+    <param name="on">true for lazy mode, false for immediate mode. Default: true</param>
+    */
+    void SetLazy(bool on = true);
+    /**
+    <returns>true in lazy mode.</returns>
+    */
+    bool IsLazy() const { return graph != nullptr; }
+    /**
+    <summary>Executes the pending operations of the lazy mode. Does nothing in immediate mode.</summary>
+    <returns>true if operation successfull, false if image is empty.</returns>
     */
-    int32_t *GetData() { return data; }
+    bool Materialize();
     /**
     Reads a color image and copies the specified color. Use this method if you read in a gray-image stored as RGB.
     The routine can of course also be used for fancy effects</summary>
-    <param name="fileName"> Full filename of image. Example: "./image/Lena.jpg"</param>
+    <param name="src"> Full filename of image or the encoded image. Example: "./image/Lena.jpg"</param>
     <param name="color">the color channel. R==0, G=1, B=2, Default: 0 (Red)</param>
     <returns>true if operation successfull, false if one can not read the image or invalid color channel</returns>
     */
-    bool ColorChannel(const string fileName,int color = 0);
+    bool ColorChannel(const MLSource& src,int color = 0);
     /**
     <summary> Reads a color image and converts it to Saturated-Gray with gray intensity I.
     I = wRed*RED + wGreen*GREEN + wBlue*BLUE.
@@ -106,29 +208,30 @@ public:
     The only restriction is that they must not create an int32-Overflow.
     If the original image is gray, the values are just copied.
     </summary>
-    <param name="fileName"> Full filename of image. Example: "./image/Lena.jpg"</param>
+    <param name="src"> Full filename of image or the encoded image. Example: "./image/Lena.jpg"</param>
     <param name="wRed">weight of Red Image component</param>
     <param name="wGreen">weight of Green Image component</param>
     <param name="wBlue">weight of Blue Image component</param>
     <returns>true if operation successfull, false if one can not read the image file).</returns>
     */
-    bool Saturate(const string fileName, double wRed, double wGreen, double wBlue);
+    bool Saturate(const MLSource& src, double wRed, double wGreen, double wBlue);
     /**
     <summary>Convenience function. Calls Saturate() with the weights of GIMP (0.3,0.596,0.11)</summary>
     <param name="scaleFac">The GIMP-weights are multiplied by scaleFac. Default: 1.0</param>
     <returns>true if operation successfull, false if one can not read the image file.</returns>
     */
-    bool SaturateGIMP(const string fileName, double scaleFac = 1.0);
+    bool SaturateGIMP(const MLSource& src, double scaleFac = 1.0);
     /**
      <summary>Convenience function. Calls Saturate() with the weights of Qt (0.34375,0.5,0.1625)
       Qt uses actually integer multiplication with 11/32, 16/32, 5/32	</summary>
-     <param name="fileName"> Full filename of image. Example: "./image/Lena.jpg"</param>
+     <param name="src"> Full filename of image or the encoded image. Example: "./image/Lena.jpg"</param>
      <param name="scaleFac">The Qt-weights are multiplied by scaleFac</param>
     <returns>true if operation successfull, false if one can not read the image file.</returns>
      */
-    bool SaturateQt(const string fileName, double scaleFac = 1.0);
+    bool SaturateQt(const MLSource& src, double scaleFac = 1.0);
     /**
     <summary>Copies gray-scale data to the internal array. The width and height must match. This is not checked.
+    The pixels of d are stored line-wise without padding.
     This method is called when a gray-image is loaded.
     </summary>
      <param name="d">The original gray values</param>
@@ -140,19 +243,19 @@ public:
     I=(Max(R,G,B)+min(R,G,B))/2. 
     This is an option in GIMP
     </summary>
-	<param name="fileName"> Full filename of image. Example: "./image/Lena.jpg"</param>
+	<param name="src"> Full filename of image or the encoded image. Example: "./image/Lena.jpg"</param>
     <returns>true if operation successfull, false if one can not read the image file.</returns>
    */
-	bool Desaturate(const string fileName);
+	bool Desaturate(const MLSource& src);
 	/**
 	<summary> Converts a Color image with gray scale intensity I set to:
     I=Max(R,G,B). 
     This is an option in GIMP.
     </summary>
-    <param name="fileName"> Full filename of image. Example: "./image/Lena.jpg"</param>
+    <param name="src"> Full filename of image or the encoded image. Example: "./image/Lena.jpg"</param>
     <returns>true if operation successfull, false if one can not read the image file.</returns>
  	*/
-	bool Value(const string fileName);
+	bool Value(const MLSource& src);
 	/**
     <summary>Converts a Color image with gray scale intensity I set to: 
             Y = (0.299 * R) + (0.587 * G) + (0.114 * B);  Standard Conversion
@@ -161,11 +264,11 @@ public:
             I= Y + factor*(U+V);     U+V is a measure of the effect.
             It tries to correct the grayscale by the HelmholtzKohlrausch effect.
     </summary>
-    <param name="fileName"> Full filename of image. Example: "./image/Lena.jpg"</param>
+    <param name="src"> Full filename of image or the encoded image. Example: "./image/Lena.jpg"</param>
     <param name="factor"> The weight of the Helmholtz-Kohlrausch effect</param>
     <returns>true if operation successfull, false if one can not read the image file.</returns>
     */
-	bool Helmholtz(const string fileName,double factor=0.149);
+	bool Helmholtz(const MLSource& src,double factor=0.149);
     /**
     <summary> Applies a logistic transformation to the gray scales I of an existing image. Values of middle intensities
               are stretched, almost BLACK or WHITE moved towards BLACK or WHITE. 
@@ -278,9 +381,12 @@ public:
     </summary>
     <param name="from">The threshold search is done within range [from,to]. Default: 64</param>
     <param name="to">The threshold search is done within range [from,to]. Default: 192</param>
+    <param name="proxy">If greater 1, the search is done coarse-to-fine. See OptHalftone(). Default: 1</param>
+    <param name="validate">Reports the difference of the coarse-to-fine result to the full search. Default: false</param>
+    <param name="l2">Uses the L2- instead of the L1-distance. Default: false</param>
     <returns>the best threshold or -1 if image is empty.</returns>
     */
-    int OptFloydSteinberg(int from = 64, int to = 192);
+    int OptFloydSteinberg(int from = 64, int to = 192, int proxy = 1, bool validate = false, bool l2 = false);
     /**
     <summary>Implements "minimized average error" halftoning algorithm by J.Jarvis, C.Judice and W. Ninke
     The algorithm is similar to Floyd-Steinberg. The diffusion mask is larger. 
@@ -298,9 +404,12 @@ public:
     The image is dithered with the optimal threshold.
     <param name="from">The threshold search is done within range [from,to]. Default: 64</param>
     <param name="to">The threshold search is done within range [from,to]. Default: 192</param>
+    <param name="proxy">If greater 1, the search is done coarse-to-fine. See OptHalftone(). Default: 1</param>
+    <param name="validate">Reports the difference of the coarse-to-fine result to the full search. Default: false</param>
+    <param name="l2">Uses the L2- instead of the L1-distance. Default: false</param>
     <returns>the best threshold or -1 if image is empty.</returns>
     */
-    int OptJarvis(int from = 64, int to = 192);
+    int OptJarvis(int from = 64, int to = 192, int proxy = 1, bool validate = false, bool l2 = false);
     /**
     <summary>Implements "MECCA - A multiple error correction computation algorithm for bilevel hardcopy reproduction" by P. Stucki
     The algorithm is very similar to Jarvis. The mask is the same, the weights are slightly different. 
@@ -318,9 +427,42 @@ public:
     The image is dithered with the optimal threshold.
     <param name="from">The threshold search is done within range [from,to]. Default: 64</param>
     <param name="to">The threshold search is done within range [from,to]. Default: 192</param>
+    <param name="proxy">If greater 1, the search is done coarse-to-fine. See OptHalftone(). Default: 1</param>
+    <param name="validate">Reports the difference of the coarse-to-fine result to the full search. Default: false</param>
+    <param name="l2">Uses the L2- instead of the L1-distance. Default: false</param>
     <returns>the best threshold or -1 if image is empty.</returns>
     */
-    int OptStucki(int from = 64, int to = 192);
+    int OptStucki(int from = 64, int to = 192, int proxy = 1, bool validate = false, bool l2 = false);
+    /**
+    <summary>Implements the error diffusion of D. Burkes. A simplified Stucki with only 2 lines.
+      .   .   x   8   4
+      2   4   8   4   2     divided by 32
+    </summary>
+    <param name="threshold">The pixel is set to WHITE if the diffused I>=threshold.</param>
+    <returns>true if operation successfull, false if image is empty.</returns>
+    */
+    bool Burkes(int32_t threshold = 128);
+    /**
+    <summary>Implements the Sierra-Lite error diffusion of F. Sierra. The fastest error diffusion with a quality
+    close to Floyd-Steinberg.
+      .   x   2
+      1   1   .     divided by 4
+    </summary>
+    <param name="threshold">The pixel is set to WHITE if the diffused I>=threshold.</param>
+    <returns>true if operation successfull, false if image is empty.</returns>
+    */
+    bool SierraLite(int32_t threshold = 128);
+    /**
+    <summary>Implements the error diffusion of B. Atkinson (Apple MacPaint). Only 3/4 of the error is diffused.
+    This gives more contrast, but details in very bright and dark regions are lost.
+      .   x   1   1
+      1   1   1   .
+      .   1   .   .     divided by 8
+    </summary>
+    <param name="threshold">The pixel is set to WHITE if the diffused I>=threshold.</param>
+    <returns>true if operation successfull, false if image is empty.</returns>
+    */
+    bool Atkinson(int32_t threshold = 128);
     /**
     <summary> Implements the halftoning algorithm from:  Victor Ostromoukhov: "A Simple and Efficient Error-Diffusion Algorithm"
      The algorithm uses for each grayscale an own error-diffusion matrix. The Matrix was optimized to eliminate noise.
@@ -336,21 +478,40 @@ public:
     </summary>
     <param name="from">The threshold search is done within range [from,to]. Default: 64</param>
     <param name="to">The threshold search is done within range [from,to]. Default: 192</param>
+    <param name="proxy">If greater 1, the search is done coarse-to-fine. See OptHalftone(). Default: 1</param>
+    <param name="validate">Reports the difference of the coarse-to-fine result to the full search. Default: false</param>
+    <param name="l2">Uses the L2- instead of the L1-distance. Default: false</param>
     <returns>the best threshold or -1 if image is empty.</returns>
     */
-    int OptOstromoukhov(int from=64,int to=192);
+    int OptOstromoukhov(int from = 64, int to = 192, int proxy = 1, bool validate = false, bool l2 = false);
      /**
     <summary> Selects the optimal threshold. Best is defined as the L1-distance between
      the 7x7 Gauss-Filter of the original image and the 7x7 Gauss-Filter of the Halftone.
      The image is dithered with the optimal threshold.
      The method is called by the Opt... methods above and does the real work.
+     The search evaluates every 4th threshold and refines +-3 around the best one.
+     In coarse-to-fine mode (proxy > 1) this search is done on a 1/proxy downscaled copy of the image. 
+     Only +-3 around the optimum of the proxy are evaluated at full resolution. This is about proxy^2 times faster.
+     The distance between the proxy optimum and the final threshold is reported. With validate the full search
+     is done additionally, and the difference of threshold and distance to its result is reported.
     </summary>
     <param name="from">The threshold search is done within range [from,to]. Default: 64</param>
     <param name="to">The threshold search is done within range [from,to]. Default: 192</param>
-     <param name="halftoneId">The underlying Halftone-Algo. One of FLOYDSTEINBERG,OSTROMOUKHOV,JARVIS</param>
+     <param name="halftoneId">The underlying Halftone-Algo. One of FLOYDSTEINBERG,OSTROMOUKHOV,JARVIS,STUCKI</param>
+    <param name="proxy">The downscale factor of the proxy image, typically 4 or 8. 1 searches at full resolution.</param>
+    <param name="validate">If true and proxy > 1, the full resolution search is done additionally for comparison</param>
+    <param name="l2">If true, the L2-distance (sum of squares) is used instead of the L1-distance</param>
     <returns>the best threshold or -1 if image is empty or halftoneId is invalid.</returns>
     */
-    int OptHalftone(int from, int to,const int halftoneId);
+    int OptHalftone(int from, int to, const int halftoneId, int proxy = 1, bool validate = false, bool l2 = false);
+    /**
+    <summary>Downscales the image by averaging factor x factor blocks. The remaining right columns and bottom rows 
+    are ignored.</summary>
+    <param name="proxy">The downscaled image.</param>
+    <param name="factor">The downscale factor.</param>
+    <returns>true if operation successfull, false if image is empty or smaller than factor.</returns>
+    */
+    bool Downscale(MLGray& proxy, int factor);
     /**
     <summary>Implements ordered Dither with a 4x4 Bayer matrix.</summary>
     <returns>true if operation successfull, false if image is empty.</returns>
@@ -362,14 +523,30 @@ public:
     */
     bool Bayer88();
     /**
+    <summary>Implements ordered Dither with a Bayer matrix of size x size (see Bayer.h).</summary>
+    <param name="size">The size of the Bayer matrix. One of 2,4,8,16,32,64. Default: 16</param>
+    <returns>true if operation successfull, false if image is empty or size is invalid.</returns>
+    */
+    bool Bayer(int size = 16);
+    /**
     <summary>Implements ordered Dither with a 8x8 Bayer matrix. Before accessing the Bayer-Matrix
     a uniform distributed random number from [-range,range] is added to the pixel value. This should
-    break the regular patterns created by the Bayer Matrix
+    break the regular patterns created by the Bayer Matrix. The random number is a hash of the pixel position 
+    and the seed (see PixelRandom.h). The result is independent of the number of threads.
     </summary>
     <param name="range">The uniform distribution is created int [-range,range]. Default: 20</param>
+    <param name="seed">The seed of the random generator. Default: 47114713</param>
     <returns>true if operation successfull, false if image is empty.</returns>
     */
-    bool BayerRnd88(int32_t range=20);
+    bool BayerRnd88(int32_t range=20, uint32_t seed = 47114713);
+    /**
+    <summary>Implements ordered Dither with a blue noise threshold mask (see BlueNoise.h). The mask has no regular
+    pattern. The quality is close to error diffusion, but each pixel is independent of the others.
+    The lines are processed in parallel.
+    </summary>
+    <returns>true if operation successfull, false if image is empty.</returns>
+    */
+    bool BlueNoise();
     /**
     <summary> Trivial Dither.</summary>
     <param name="threshold">The pixel is set to WHITE if the I>=threshold.</param>
@@ -377,10 +554,14 @@ public:
     */
     bool Threshold(int32_t threshold = 128);
     /**
-    <summary> Creates for each pixel a random integer in [0,255]. If I >= Rand Dither is WHITE, otherwise BLACK. </summary>
+    <summary> Creates for each pixel a random integer in [0,255]. If I >= Rand Dither is WHITE, otherwise BLACK. 
+    The random number is a hash of the pixel position and the seed (see PixelRandom.h). 
+    The lines are processed in parallel, the result is independent of the number of threads.
+    </summary>
+    <param name="seed">The seed of the random generator. Default: 47114713</param>
     <returns>true if operation successfull, false if image is empty.</returns>
     */
-    bool Random();
+    bool Random(uint32_t seed = 47114713);
     /**
     <summary> Postprocessing of image. Removes Salt and Pepper. Flips Pixel if there are too less
     of own color in 3x3 region.
@@ -412,19 +593,22 @@ public:
      */
     bool Invert();
     /**
-    <summary> Generates a linear gradient image from black to white with the size 512x512</summary>
+    <summary> Generates a linear gradient image from black to white with the size width x height (default 512x512).
+    For other image sources see Synthetic, e.g. "@noise:1:4096:4096" as input file.</summary>
     <param name="blackToWhite">If true the image starts on the left with BLACK and increase to the right to WHITE.
     If false, it starts with WHITE and decreases to BLACK.</param>
     */
-    void LinearGradient(bool blackToWhite=true);
+    void LinearGradient(bool blackToWhite=true, int width=512, int height=512);
     /**
-     <summary> Generates a radial gradient image from black to white with the size 512x512</summary>
+     <summary> Generates a radial gradient image from black to white with the size width x height (default 512x512).
+     The distance to the middle is scaled as in a 512x512 image, so the corners exceed WHITE.</summary>
     <param name="blackToWhite">If true the image starts in the middle with BLACK and radiates outside to WHITE.
     If false, it starts with WHITE and decreases to BLACK.  </param>
     */
-    void RadialGradient(bool blackToWhite = true);
+    void RadialGradient(bool blackToWhite = true, int width = 512, int height = 512);
     /**
-    <summary> Saves the image in *.jpg format. The image is stored as a RGB-color-image with same values for R,G,B.
+    <summary> Saves the image in *.jpg format. The image is stored as grayscale image with one component, the values are
+    clamped to 0..255. Large images are encoded in parallel, see JpegWriter.</summary>
     <param name="fileName"> Full Filename. example: "./image/LinearGradient.jpg"</param>
     <param name="quality">The compression quality of the image. Default: 100. Highest quality</param>
     <returns>true if operation successfull, false if failed.</returns>
@@ -432,8 +616,14 @@ public:
     bool SaveImage(string fileName, int quality = 100);
     /**
     <summary>Converts the data array to the representation of the Stb_image data</summary>
+    <returns>The Stb_image data. It has to be deleted by the caller with delete[].</returns>
     */
     unsigned char* ToStb();
+    /**
+    <summary>Same as ToStb(), but writes to img.</summary>
+    <param name="img">The Stb_image data. It must have at least width*height*3 elements.</param>
+    */
+    void ToStb(unsigned char* img);
 
 private:
     const int RGB_Channels = 3;
@@ -446,58 +636,106 @@ private:
     const int OSTROMOUKHOV = 1; 
     const int JARVIS = 2;
     const int STUCKI=3;
-    double L1Distance(double* f1, double* f2, int sz);
-    double L2Distance(double* f1, double* f2, int sz);
-    inline int pos(int x, int y) { return y * width + x; }
-	inline int line(int y) { return y * width; }
+    /**
+    <summary>The error diffusion engine. The diffusion matrix K is a compile-time parameter (see Diffusion.h).
+    The loops are fully unrolled and branch-free. The error which leaves the image is diffused into the ghost border
+    and dropped. Only kernels with an EdgeDown weight have an own path for the first and last column.
+    </summary>
+    <param name="threshold">The pixel is set to WHITE if the diffused I>=threshold.</param>
+    <returns>true if operation successfull, false if image is empty.</returns>
+    */
+    template<class K> bool ErrorDiffusion(int32_t threshold);
+    /**
+    <summary>Calls the halftone algorithm halftoneId with threshold.</summary>
+    */
+    bool Halftone(int32_t threshold, const int halftoneId);
+    /**
+    <summary>The threshold search of OptHalftone(). Evaluates the thresholds from,from+step,...,to and 
+    refines +-(step-1) around the best one. The image is not modified.
+    The Gauss filter of the candidates and the distance are fused in BlurScore::Distance().
+    </summary>
+    <param name="bestDist">The distance per pixel of the best threshold.</param>
+    <param name="norm">BlurScore::L1 or BlurScore::L2</param>
+    <returns>the best threshold</returns>
+    */
+    int SearchThreshold(int from, int to, int step, const int halftoneId, double& bestDist, int norm);
+    /**
+    <summary>The ordered dither engine for the Bayer matrix of size 2^K. The matrix is generated at compile time.
+    Each line of the matrix is tiled once across the width of the image. Every pixel, including the border, is then
+    a plain compare of 2 lines, which is vectorized by the compiler. The lines are processed in parallel.
+    </summary>
+    <param name="range">If greater 0, a random number from [-range,range] is added to each pixel (see BayerRnd88())</param>
+    <param name="seed">The seed of the random numbers</param>
+    <returns>true if operation successfull, false if image is empty.</returns>
+    */
+    template<int K> bool OrderedDither(int32_t range = 0, uint32_t seed = 0);
+    /**
+    <summary>Copies the first and last line and column of the image to dst. dst must have the same stride.
+    The filters which do not change the border write the inner pixels to a Buffer() and Replace() data with it.</summary>
+    */
+    void CopyBorder(int32_t* dst);
+    /**
+    <returns>An image of the same size and stride. The content is undefined.</returns>
+    */
+    MLGray Buffer();
+    /**
+    <summary>The decoder of LoadImage().</summary>
+    */
+    unsigned char* Decode(const MLSource& src, int& width, int& height, int& channels);
+    /**
+    <summary>Copies the pixels to dst. dst must have the same size.</summary>
+    */
+    void CopyTo(MLGray& dst);
+    /**
+    <summary>Replaces the pixels with the pixels of t. t must have the same size. An image swaps the buffers,
+    a view copies the pixels.</summary>
+    */
+    void Replace(MLGray& t);
+    /**
+    <summary>The ghost border of a view are the pixels of the image around it. Operations which write into the ghost 
+    border run op on a copy of the view from the Arena and copy the result back.</summary>
+    */
+    template<class F> bool Detached(F op);
+    /**
+    <summary>Allocates the storage for an image of size w*h. The previous storage is reused if it is large enough.
+    </summary>
+    <param name="s">The stride. 0 selects the smallest aligned stride for w.</param>
+    */
+    bool Allocate(int w, int h, int s = 0);
+    inline int pos(int x, int y) { return y * stride + x; }
+	inline int line(int y) { return y * stride; }
 	inline int clamp(int c) { return (c < 0) ? BLACK : (c <= WHITE) ? c : WHITE; }
 
     inline int32_t MedianMsk9(int x) {
-        return Median9(data[x - width - 1], data[x - width], data[x - width + 1],
+        return Median9(data[x - stride - 1], data[x - stride], data[x - stride + 1],
             data[x - 1], data[x], data[x + 1],
-            data[x + width - 1], data[x + width], data[x + width + 1]);
+            data[x + stride - 1], data[x + stride], data[x + stride + 1]);
     }
 
     inline int32_t MedianMsk5(int x) {
-        return Median5(data[x - width],data[x - 1], data[x], data[x + 1],data[x + width]);
+        return Median5(data[x - stride],data[x - 1], data[x], data[x + 1],data[x + stride]);
     }
 
-
-    inline int32_t Accumulate33(int x,int y) {
-        int32_t v=0;
-        for (int dy = -1; dy <= 1; dy++) {
-            int py = y + dy;
-            if (py < 0) { continue; }
-            if (py >= height) { break; }
-            for (int dx = -1; dx <= 1; dx++) {
-                int px = x + dx;
-                if (px < 0) { continue; }
-                if (px >= width) { break; }
-                v += data[py * width + px];
-            }
-        }
-        return v;
+    /**
+    <summary>The sum of the 3x3 neighborhood of the pixel x. Pixels outside the image count as 0.
+    The border must be filled with FillBorder(ZERO).</summary>
+    */
+    inline int32_t Accumulate33(int x) {
+        const int32_t* u = data + x - stride;
+        const int32_t* c = data + x;
+        const int32_t* b = data + x + stride;
+        return u[-1] + u[0] + u[1] + c[-1] + c[0] + c[1] + b[-1] + b[0] + b[1];
     }
 
-     inline int32_t Accumulate8(int x,int y) {
-        int32_t v=0;
-        for (int dy = -1; dy <= 1; dy++) {
-            int py = y + dy;
-            if (py < 0) { continue; }
-            if (py >= height) { break; }
-            for (int dx = -1; dx <= 1; dx++) {
-                if((dy==0)&&(dx==0)) { continue; }
-                int px = x + dx;
-                if (px < 0) { continue; }
-                if (px >= width) { break; }
-                v += data[py * width + px];
-            }
-        }
-        return v;
+    /**
+    <summary>Same as Accumulate33() without the center pixel.</summary>
+    */
+    inline int32_t Accumulate8(int x) {
+        return Accumulate33(x) - data[x];
     }
 
 
-    const double* Gauss77Msk = new double[49]  {
+    static constexpr double Gauss77Msk[49] = {
           1.0,  6.0, 15.0, 20.0, 15.0,  6.0, 1.0,
           6.0, 36.0, 90.0,120.0, 90.0, 36.0, 6.0,
          15.0, 90.0,225.0,300.0,225.0, 90.0,15.0,
@@ -515,47 +753,41 @@ private:
 
     */
 	inline int32_t Conv33(int x, const int32_t* w) {
-		int32_t v = w[0] * data[x - width - 1];
-		v += w[1] * data[x - width];
-		v += w[2] * data[x - width+1];
+		int32_t v = w[0] * data[x - stride - 1];
+		v += w[1] * data[x - stride];
+		v += w[2] * data[x - stride+1];
 		v += w[3] * data[x - 1];
 		v += w[4] * data[x];
 		v += w[5] * data[x+1];
-		v += w[6] * data[x + width-1];
-		v += w[7] * data[x + width];
-		v += w[8] * data[x + width+1];
+		v += w[6] * data[x + stride-1];
+		v += w[7] * data[x + stride];
+		v += w[8] * data[x + stride+1];
 		return v;
 	}
 	int width;
 	int height;
+    /**
+    <summary>The storage of the image. data points to pixel (0,0) inside frame. Around the image is a ghost border
+    of GHOST pixels. The lines are stride elements apart and aligned to 64 bytes.</summary>
+    */
+    int stride = 0;
 	int32_t* data;
+    int32_t* frame = nullptr;
     /**
-    <summary>The weights of the Laplace filter</summary>
+    <summary>The recorded operations in lazy mode. nullptr in immediate mode</summary>
     */
-	const int32_t* Laplace =  new int32_t[9]{ 
-        1, 1, 1, 
-        1,-8, 1, 
-        1, 1, 1 };
+    MLGraph* graph = nullptr;
     /**
-    <summary>The 4x4 Bayer ordered dither mask</summary>
+    <summary>Records the operation in lazy mode. See MLGraph::Add()</summary>
     */
-    const int32_t* BayerMsk44 = new int32_t[16]{
-          15,143, 47,175,
-         207, 79,239,111,
-          63,191, 31,159,
-         255,127,223, 95};
+    bool Defer(int op, double p1 = 0.0, double p2 = 0.0);
     /**
-    <summary>The 8x8 Bayer ordered dither mask</summary>
+    <summary>The weights of the Laplace filter</summary>
     */
-    const int32_t* BayerMsk88 = new int32_t[64]{
-     4 *  0+3, 4 * 32+3, 4 * 8+3 , 4 * 40+3, 4 *  2+3, 4 * 34+3, 4 * 10+3, 4 * 42+3,
-     4 * 48+3, 4 * 16+3, 4 * 56+3, 4 * 24+3, 4 * 50+3, 4 * 18+3, 4 * 58+3, 4 * 26+3,
-     4 * 12+3, 4 * 44+3, 4 *  4+3, 4 * 36+3, 4 * 14+3, 4 * 46+3, 4 *  6+3, 4 * 38+3,
-     4 * 60+3, 4 * 28+3, 4 * 52+3, 4 * 20+3, 4 * 62+3, 4 * 30+3, 4 * 54+3, 4 * 22+3,
-     4 * 3+3 , 4 * 35+3, 4 * 11+3, 4 * 43+3, 4 *  1+3, 4 * 33+3, 4 *  9+3, 4 * 41+3,
-     4 * 51+3, 4 * 19+3, 4 * 59+3, 4 * 27+3, 4 * 49+3, 4 * 17+3, 4 * 57+3, 4 * 25+3,
-     4 * 15+3, 4 * 47+3, 4 *  7+3, 4 * 39+3, 4 * 13+3, 4 * 45+3, 4 *  5+3, 4 * 37+3,
-     4 * 63+3, 4 * 31+3, 4 * 55+3, 4 * 23+3, 4 * 61+3, 4 * 29+3, 4 * 53+3, 4 * 21+3 };
+	static constexpr int32_t Laplace[9] = { 
+        1, 1, 1, 
+        1,-8, 1, 
+        1, 1, 1 };
     /**
     <summary>
     The diffusion coefficients for the Ostromoukhov-Algorithm. 
@@ -564,7 +796,7 @@ private:
     redundant, but it is specified in the implementation of Victor Ostromoukhov.
     </summary>
     */
-    const int32_t* OstromC =  new int32_t[1024] {
+    static constexpr int32_t OstromC[1024] = {
     13,     0,     5,    18,
     13,     0,     5,    18,     
     21,     0,    10,    31,     
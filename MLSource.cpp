@@ -0,0 +1,59 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "MLSource.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+#ifdef _WIN32
+MappedFile::MappedFile(const string& fileName) {
+	HANDLE f = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE) { return; }
+	file = f;
+	LARGE_INTEGER s;
+	if (!GetFileSizeEx(f, &s) || (s.QuadPart == 0)) { return; }
+	mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) { return; }
+	data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size = (data != nullptr) ? (size_t)s.QuadPart : 0;
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) { UnmapViewOfFile(data); }
+	if (mapping != nullptr) { CloseHandle(mapping); }
+	if (file != nullptr) { CloseHandle(file); }
+}
+#else
+MappedFile::MappedFile(const string& fileName) {
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) { return; }
+	struct stat s;
+	if ((fstat(fd, &s) == 0) && (s.st_size > 0)) {
+		void* p = mmap(nullptr, (size_t)s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) {
+			madvise(p, (size_t)s.st_size, MADV_SEQUENTIAL);
+			data = (const unsigned char*)p;
+			size = (size_t)s.st_size;
+		}
+	}
+	close(fd);  // The mapping keeps the file open
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) { munmap((void*)data, size); }
+}
+#endif
@@ -0,0 +1,84 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+<summary>
+    The input of the color to grayscale conversions of MLGray. Either the name of a *.jpg file or a buffer with the
+    encoded image, e.g. from a cache or a socket. A file name converts implicitly, so img.SaturateGIMP("./image/Lena.jpg")
+    works as before. The buffer is not copied, it must stay valid during the conversion.
+    A name which starts with @ is a synthetic image, e.g. "@gradient:4096:4096", see Synthetic.
+</summary>
+*/
+class MLSource {
+public:
+    MLSource(const std::string& fileName) : fileName(fileName) {}
+    MLSource(const char* fileName) : fileName(fileName) {}
+    /**
+    <param name="data">The encoded image, e.g. the contents of a *.jpg file.</param>
+    <param name="size">The size of data in bytes.</param>
+    */
+    MLSource(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+    /**
+    <returns>The file name. Empty for a buffer.</returns>
+    */
+    const std::string& FileName() const { return fileName; }
+    /**
+    <returns>The encoded image. nullptr for a file.</returns>
+    */
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+    /**
+    <summary>Sets the downscale factor of the conversion, e.g. for previews. A JPEG is decoded at reduced size from
+    the DCT coefficients, see JpegReader. Other images are decoded at full size and reduced by the box mean.</summary>
+    <param name="s">1, 2, 4 or 8. The size of the image is divided by s and rounded up.</param>
+    */
+    void SetScale(int s) { scale = s; }
+    int Scale() const { return scale; }
+
+private:
+    std::string fileName;
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    int scale = 1;
+};
+
+/**
+<summary>
+    A read-only memory mapping of a file. The kernel is told that the file is read sequentially, so it reads ahead.
+    Several processes which read the same input share the pages of the page cache, the file is not copied into a
+    private buffer.
+</summary>
+*/
+class MappedFile {
+public:
+    /**
+    <summary>Maps the file. Data() is nullptr if the file can not be opened or mapped.</summary>
+    */
+    explicit MappedFile(const std::string& fileName);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
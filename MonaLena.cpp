@@ -2,385 +2,490 @@
 #include <sstream>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <thread>
+#include <vector>
 #include "MLGray.h"
+#include "Arena.h"
+#include "BlueNoise.h"
+#include "BoundedQueue.h"
+#include "Command.h"
+#include "CommandFile.h"
+#include "Parallel.h"
+#include "PerfCounters.h"
+#include "Planner.h"
+#include "ResultCache.h"
+#include "Server.h"
+#include "Trace.h"
 using namespace std;
 
 /**
-<summary> Parses the integer parameter of a command. E.g. FloydSteinberg:130</summary>
-<param name="cmd">The command.</param>
-<param name="v">The parsed value.</param>
-<returns>true if parameter can be parsed, otherwise false</returns>
+<summary>The time in ms spent in the stages of a command line.</summary>
 */
-bool Param(string cmd, int& v) {
-	int p = cmd.find(':');
-	if (p < 0) { return false; }
-	try {
-		v = stoi(cmd.substr(p+1));
-		return true;
-	}
-	catch (invalid_argument e) {
-		return false;
-	}
-}
+struct RowTiming {
+	double read = 0.0;
+	double preprocess = 0.0;
+	double halftoning = 0.0;
+	double postprocess = 0.0;
+	double save = 0.0;
+	bool cached = false;  // The output was up to date, nothing was computed. See ResultCache.
+};
 
 /**
-<summary> Parses the double parameter of a command. E.g. SaturateGIMP:1.1</summary>
-<param name="cmd">The command.</param>
-<param name="v">The parsed value.</param>
-<returns>true if parameter can be parsed, otherwise false</returns>
+<summary>Sets the ResultCache key of the row.</summary>
+<returns>true if the output of the row is up to date.</returns>
 */
-bool Param(string cmd, double& v) {
-	int p = cmd.find(':');
-	if (p < 0) { return false; }
-	try {
-		v = stod(cmd.substr(p + 1));
-		return true;
-	}
-	catch (invalid_argument e) {
-		cout << "Param stod exception" << endl;
-		return false;
-	}
+bool UpToDate(Row& row) {
+	if (row.output.empty()) { return false; }
+	string pipeline;
+	for (int stage = READ; stage <= POSTPROCESS; stage++) { pipeline += row.StageKey(stage) + ","; }
+	row.key = ResultCache::Key(row.input, pipeline);
+	if (!ResultCache::Hit(OutputFile(row.output), row.key)) { return false; }
+	Diagnostic(row.lineNr, row.output + " is up to date");
+	return true;
 }
 
 /**
-<summary> Parses the 3 double parameters of a command. E.g. Saturate:0.3:0.6:0.1</summary>
-<param name="cmd">The command.</param>
-<param name="v1,v2,v3">The parsed parameter values.</param>
-<returns>true if parameters can be parsed, otherwise false</returns>
+<summary>The measurement of a stage of a line.</summary>
 */
-bool Param3(string cmd, double& v1,double& v2,double &v3) {
-	int p = cmd.find(':');
-	if (p < 0) { return false; }
-	try {
-		istringstream s(cmd.substr(p + 1));
-		string ps;
-		for (int n=1; (n <= 3) && (getline(s, ps, ':')); n++) {
-			if (n == 1) { v1 = stod(ps); }
-			if (n == 2) { v2 = stod(ps); }
-			if (n == 3) { 
-				v3 = stod(ps);
-				return true;
-			}
-		}
-		return false;
-	}
-	catch (invalid_argument e) {
-		cout << "Param3 stod exception" << endl;
-		return false;
-	}
-}
+struct StageStats {
+	bool done = false;  // false if the stage was shared with an earlier line or not performed
+	double ms = 0.0;
+	double decodeMs = 0.0;  // READ: the part of ms spent in MLGray::LoadImage()
+	long long pixels = 0;  // The size of the image or region
+	size_t bytes = 0;  // The memory requested from the Arena by the thread of the stage
+	PerfCounters::Sample counters;  // Including the workers of Parallel::For()
+};
+
+struct RowStats {
+	StageStats stage[SAVE + 1];
+};
 
 /**
-<summary> Parses the 2 double parameters of a command. E.g. Rescale:25.0:1.0</summary>
-<param name="cmd">The command.</param>
-<param name="v1,v2">The parsed parameter values.</param>
-<returns>true if parameters can be parsed, otherwise false</returns>
+<summary>Performs a stage with RunStage() and measures it with a monotonic clock.</summary>
+<param name="stats">Receives the measurement. nullptr if the stage is not measured.</param>
 */
-bool Param2(string cmd, double& v1, double& v2) {
-	int p = cmd.find(':');
-	if (p < 0) { return false; }
-	try {
-		istringstream s(cmd.substr(p + 1));
-		string ps;
-		for (int n = 1; (n <= 2) && (getline(s, ps, ':')); n++) {
-			if (n == 1) { v1 = stod(ps); }
-			if (n == 2) { 
-				v2 = stod(ps); 
-				return true;
-			}
-		}
-		return false;
-	}
-	catch (invalid_argument e) {
-		cout << "Param2 stod exception" << endl;
-		return false;
-	}
+bool MeasureStage(int stage, const Row& row, MLGray& img, bool lazy, StageStats* stats) {
+	if (stats == nullptr) { return RunStage(stage, row, img, lazy); }
+	size_t bytes = Arena::ThreadBytes();
+	PerfCounters::Sample counters = PerfCounters::Read();
+	auto start = chrono::steady_clock::now();
+	bool ok = RunStage(stage, row, img, lazy);
+	stats->ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	stats->counters = PerfCounters::Read() - counters;
+	stats->bytes = Arena::ThreadBytes() - bytes;
+	if (stage == READ) { stats->decodeMs = min(MLGray::LastDecodeMs(), stats->ms); }
+	int w = img.GetWidth();
+	int h = img.GetHeight();
+	if (row.region && (stage != READ) && (stage != SAVE)) {  // The clipped region, see MLGray::View()
+		w = max(0, min(row.roi[0] + row.roi[2], w) - max(row.roi[0], 0));
+		h = max(0, min(row.roi[1] + row.roi[3], h) - max(row.roi[1], 0));
+	}
+	stats->pixels = (long long)w * h;
+	stats->done = true;
+	return ok;
 }
 
 /**
-<summary> Parses the 2 integer parameters of a command. E.g. OptFloydSteinberg:30:180</summary>
-<param name="cmd">The command.</param>
-<param name="v1,v2">The parsed parameter values.</param>
-<returns>true if parameters can be parsed, otherwise false</returns>
+<summary>Writes the measured stages of the lines and a summary per operation. The READ stage is reported as decode
+and convert. A *.json report is written as JSON. Otherwise the stages are written as CSV and the summary to a second
+file, e.g. report_summary.csv for report.csv. The summary is also written to cout.
+If the performance counters are enabled, the stages get the raw counts and the summary the IPC, the LLC misses per
+pixel and the branch miss rate. The counts of the READ stage include the decoding, they are reported for convert.
+</summary>
 */
-bool Param2(string cmd, int& v1, int& v2) {
-	int p = cmd.find(':');
-	if (p < 0) { return false; }
-	try {
-		istringstream s(cmd.substr(p + 1));
-		string ps;
-		for (int n = 1; (n <= 2) && (getline(s, ps, ':')); n++) {
-			if (n == 1) { v1 = stoi(ps); }
-			if (n == 2) {
-				v2 = stoi(ps);
-				return true;
+void WriteReport(const string& fileName, const map<int, Row>& rows, const map<int, RowStats>& stats) {
+	struct Record {
+		int lineNr;
+		const Row* row;
+		const char* stage;
+		string op;
+		double ms;
+		long long pixels;
+		size_t bytes;
+		PerfCounters::Sample counters;
+	};
+	struct Sum {
+		int count = 0;
+		double ms = 0.0;
+		long long pixels = 0;
+		size_t bytes = 0;
+		PerfCounters::Sample counters;
+	};
+	bool counted = PerfCounters::Enabled();
+	const char* stageName[SAVE + 1] = { "convert", "preprocess", "halftoning", "postprocess", "save" };
+	vector<Record> records;
+	for (const auto& s : stats) {
+		const Row& row = rows.at(s.first);
+		for (int stage = READ; stage <= SAVE; stage++) {
+			const StageStats& t = s.second.stage[stage];
+			if (!t.done) { continue; }
+			if (stage == READ) {
+				records.push_back({ s.first, &row, "decode", "Decode", t.decodeMs, t.pixels, 0, PerfCounters::Sample() });
+				records.push_back({ s.first, &row, stageName[stage], row.cmd[stage].Name(), t.ms - t.decodeMs, t.pixels, t.bytes,
+					t.counters });
+			}
+			else if (stage == SAVE) {
+				records.push_back({ s.first, &row, stageName[stage], "Save", t.ms, t.pixels, t.bytes, t.counters });
+			}
+			else if (!row.cmd[stage].Empty()) {
+				records.push_back({ s.first, &row, stageName[stage], row.cmd[stage].Name(), t.ms, t.pixels, t.bytes, t.counters });
 			}
 		}
-		return false;
 	}
-	catch (invalid_argument e) {
-		cout << "Param2 stoi exception" << endl;
-		return false;
-	}
-}
+	map<string, Sum> summary;
+	for (const Record& r : records) {
+		Sum& sum = summary[string(r.stage) + "/" + r.op];
+		sum.counters.valid = (sum.count == 0) ? r.counters.valid : sum.counters.valid;
+		sum.counters += r.counters;
+		sum.count++;
+		sum.ms += r.ms;
+		sum.pixels += r.pixels;
+		sum.bytes += r.bytes;
+	}
+	auto mpixPerS = [](const Sum& s) { return (s.ms > 0.0) ? s.pixels / (s.ms * 1000.0) : 0.0; };
+	auto llcPerPixel = [](const Sum& s) { return (s.pixels > 0) ? (double)s.counters.llcMisses / s.pixels : 0.0; };
 
-/**
-<summary> Parses the second column of the *.csv file. This specifies the color to gray scale conversion.</summary>
-<param name="name">The full qualified fileName of the image.</param>
-<param name="op">The operation. E.g. GIMP.</param>
-<param name="img">The image which will be filled.</param>
-<returns> true if operation is valid and image can be read and converted. Otherwise false</returns>
-*/
-bool ConvertToGray(string fileName, string op, MLGray& img) {
-	if (op.empty()) { return false; }
-	op.erase(remove(op.begin(),op.end(), ' '), op.end());
-	double p1,p2,p3;
-	if (op.find("ColorChannel") == 0) {
-		if (Param(op, p1)) { cout << "param =" << p1 << endl; return img.ColorChannel(fileName, p1); }
-		return img.ColorChannel(fileName);
-	}
-	if (op.find("GIMP") == 0) {
-		if (Param(op, p1)) { cout << "param =" << p1 << endl; return img.SaturateGIMP(fileName, p1); }
-		return img.SaturateGIMP(fileName); 
-	}
-	if (op.find("Qt") == 0) { 
-		if (Param(op, p1)) { return img.SaturateQt(fileName, p1); }
-		return img.SaturateQt(fileName);
-	}
-	if (op.find("Helmholtz") == 0) { 
-		if (Param(op, p1)) { return img.Helmholtz(fileName, p1); }
-		return img.Helmholtz(fileName);
-	}
-	if (op.find("Desaturate") == 0) { return img.Desaturate(fileName); }
-	if (op.find("Value") == 0) { return img.Value(fileName); }
-	if (op.find("Saturate") == 0) {
-		cout << "Saturate" << endl;
-		if (Param3(op, p1, p2, p3)) {
-			return img.Saturate(fileName, p1, p2, p3); 
+	bool json = (fileName.size() >= 5) && (fileName.compare(fileName.size() - 5, 5, ".json") == 0);
+	ofstream o(fileName);
+	o << fixed << setprecision(3);
+	if (json) {
+		o << "{" << endl << "  \"stages\": [" << endl;
+		for (size_t i = 0; i < records.size(); i++) {
+			const Record& r = records[i];
+			o << "    { \"line\": " << r.lineNr << ", \"output\": \"" << r.row->output << "\", \"stage\": \"" << r.stage
+				<< "\", \"operation\": \"" << r.op << "\", \"ms\": " << r.ms << ", \"pixels\": " << r.pixels
+				<< ", \"bytes\": " << r.bytes;
+			if (r.counters.valid) {
+				o << ", \"cycles\": " << r.counters.cycles << ", \"instructions\": " << r.counters.instructions
+					<< ", \"llcMisses\": " << r.counters.llcMisses << ", \"branches\": " << r.counters.branches
+					<< ", \"branchMisses\": " << r.counters.branchMisses;
+			}
+			o << " }" << ((i + 1 < records.size()) ? "," : "") << endl;
 		}
-		cout << "Param3 failed" << endl;
-		return false;
-	}
-	cout << "Unknown Grayconverter operation " << op << endl;
-	return false;
-}
-
-/**
-<summary> Parses the third column of the *.csv file. This specifies the preprocessing.</summary>
-<param name="op">The operation. E.g. Laplace.</param>
-<param name="img">The image which will be pre-processed.</param>
-<returns> true if operation is valid. Otherwise false</returns>
-*/
-bool Preprocess(string op, MLGray& img) {
-	if (op.empty()) { return false; }
-	op.erase(remove(op.begin(),op.end(), ' '),op.end());
-	double p1;
-	if (op.find("Gauss5") == 0) {
-		return img.Gauss55Filter();
-	}
-	if (op.find("Gauss7") == 0) {
-		return img.Gauss77Filter();
-	}
-	if (op.find("Laplace") == 0) {
-		if (Param(op, p1)) { return img.LaplaceSharpen(p1); }
-		return img.LaplaceSharpen();
-	}
-	if (op.find("Edge") == 0) {
-		if (Param(op, p1)) { return img.KnuthEdge(p1); }
-		return img.KnuthEdge();
-	}
-	if (op.find("MedLaplace") == 0) {
-		if (Param(op, p1)) { return img.Med5Laplace(p1); }
-		return img.Med5Laplace();
-	}
-	if (op.find("Logistic") == 0) {
-		if (Param(op, p1)) { return img.Logistic(p1); }
-		return img.Logistic();
+		o << "  ]," << endl << "  \"summary\": [" << endl;
+		size_t i = 0;
+		for (const auto& s : summary) {
+			o << "    { \"operation\": \"" << s.first << "\", \"count\": " << s.second.count << ", \"ms\": " << s.second.ms
+				<< ", \"mpixPerS\": " << mpixPerS(s.second) << ", \"bytes\": " << s.second.bytes;
+			if (s.second.counters.valid) {
+				o << ", \"ipc\": " << s.second.counters.Ipc() << ", \"llcMissesPerPixel\": " << llcPerPixel(s.second)
+					<< ", \"branchMissRate\": " << s.second.counters.BranchMissRate();
+			}
+			o << " }" << ((++i < summary.size()) ? "," : "") << endl;
+		}
+		o << "  ]" << endl << "}" << endl;
 	}
-	if (op.find("Rescale") == 0) {
-		double p2;
-		if (Param2(op, p1,p2)) { return img.Rescale(p1,p2); }
-		return img.Rescale();
+	else {
+		o << "line,output,stage,operation,ms,pixels,bytes" << (counted ? ",cycles,instructions,llcMisses,branches,branchMisses" : "")
+			<< endl;
+		for (const Record& r : records) {
+			o << r.lineNr << "," << r.row->output << "," << r.stage << "," << r.op << "," << r.ms << "," << r.pixels << ","
+				<< r.bytes;
+			if (r.counters.valid) {
+				o << "," << r.counters.cycles << "," << r.counters.instructions << "," << r.counters.llcMisses << ","
+					<< r.counters.branches << "," << r.counters.branchMisses;
+			}
+			else if (counted) {
+				o << ",,,,,";
+			}
+			o << endl;
+		}
+		size_t dot = fileName.rfind('.');
+		string summaryFile = (dot == string::npos) ? fileName + "_summary" : fileName.substr(0, dot) + "_summary" + fileName.substr(dot);
+		ofstream so(summaryFile);
+		so << fixed << setprecision(3) << "operation,count,ms,mpixPerS,bytes" << (counted ? ",ipc,llcMissesPerPixel,branchMissRate" : "")
+			<< endl;
+		for (const auto& s : summary) {
+			so << s.first << "," << s.second.count << "," << s.second.ms << "," << mpixPerS(s.second) << "," << s.second.bytes;
+			if (s.second.counters.valid) {
+				so << "," << s.second.counters.Ipc() << "," << llcPerPixel(s.second) << "," << s.second.counters.BranchMissRate();
+			}
+			else if (counted) {
+				so << ",,,";
+			}
+			so << endl;
+		}
 	}
-	if (op.find("Median") == 0) {
-		return img.MedianFilter9();
+	cout << left << setw(36) << "Stage/Operation" << right << setw(7) << "Count" << setw(12) << "ms" << setw(12) << "Mpix/s"
+		<< setw(12) << "MB";
+	if (counted) { cout << setw(8) << "IPC" << setw(12) << "LLC/pixel" << setw(12) << "BrMiss%"; }
+	cout << endl;
+	for (const auto& s : summary) {
+		cout << left << setw(36) << s.first << right << setw(7) << s.second.count << fixed << setprecision(1) << setw(12)
+			<< s.second.ms << setw(12) << mpixPerS(s.second) << setw(12) << s.second.bytes / 1048576.0;
+		if (s.second.counters.valid) {
+			cout << setprecision(2) << setw(8) << s.second.counters.Ipc() << setprecision(3) << setw(12) << llcPerPixel(s.second)
+				<< setprecision(2) << setw(12) << s.second.counters.BranchMissRate() * 100.0;
+		}
+		cout << endl;
 	}
-	cout << "WARNING: Unknown Preprocessing operation " << op << endl;
-	return false;
 }
 
 /**
-<summary> Parses the 4th column of the *.csv file. This specifies the halftone step.</summary>
-<param name="op">The operation. E.g. FloydSteinberg.</param>
-<param name="img">The image which will be dithered.</param>
-<returns> true if operation is valid. Otherwise false</returns>
+<summary>Performs the actions of one line of the command file.</summary>
+<param name="line">The command line.</param>
+<param name="lineNr">The line number for the error messages.</param>
+<param name="img">The image. Keeps its buffers between the calls.</param>
+<param name="lazy">true if a region of the image is processed in lazy mode.</param>
+<param name="cache">true if the line is skipped when its output is up to date. See ResultCache.</param>
+<param name="timing">Receives the time spent in the stages. May be nullptr.</param>
+<returns>true if the line is valid, the image could be read and converted and the output was written. Otherwise
+false</returns>
 */
-bool Halftoning(string op, MLGray& img) {
-	if (op.empty()) { return false; }
-	op.erase(remove(op.begin(), op.end(), ' '), op.end());
-	int p1,p2;
-	if (op.find("FloydSteinberg") == 0) {
-		if (Param(op, p1)) { return img.FloydSteinberg(p1); }
-		return img.FloydSteinberg();
-	}
-	if (op.find("Jarvis") == 0) {
-		if (Param(op, p1)) { return img.Jarvis(p1); }
-		return img.Jarvis();
-	}
-	if (op.find("Stucki") == 0) {
-		if (Param(op, p1)) { return img.Stucki(p1); }
-		return img.Stucki();
-	}
-	if (op.find("Ostromoukhov") == 0) {
-		if (Param(op, p1)) { return img.Ostromoukhov(p1); }
-		return img.Ostromoukhov();
-	}
-	if (op.find("OptOstromoukhov") == 0) {
-		if (Param2(op, p1, p2)) { return (img.OptOstromoukhov(p1, p2)>=0); }
-		return (img.OptOstromoukhov()>=0);
-	}
-	if (op.find("OptFloydSteinberg") == 0) {
-		if (Param2(op, p1, p2)) { return (img.OptFloydSteinberg(p1, p2) >= 0); }
-		return (img.OptFloydSteinberg() >= 0);
-	}
-	if (op.find("OptJarvis") == 0) {
-		if (Param2(op, p1, p2)) { return (img.OptJarvis(p1, p2) >= 0); }
-		return (img.OptJarvis() >= 0);
-	}
-	if (op.find("OptStucki") == 0) {
-		if (Param2(op, p1, p2)) { return (img.OptStucki(p1, p2) >= 0); }
-		return (img.OptStucki() >= 0);
-	}
-
-	if (op.find("Bayer44") == 0) {
-		return img.Bayer44();
-	}
-	if (op.find("Bayer88") == 0) {
-		return img.Bayer88();
-	}
-	if (op.find("BayerRnd88") == 0) {
-		if (Param(op, p1)) { return img.BayerRnd88(p1); }
-		return img.BayerRnd88();
-	}
-	if (op.find("Random") == 0) {
-		return img.Random();
-	}
-	if (op.find("Threshold") == 0) {
-		if (Param(op, p1)) { return img.Threshold(p1); }
-		return img.Threshold();
-	}
-	cout << "WARNING: Unknown Halftoning operation " << op << endl;
-	return false;
+bool ProcessRow(const string& line, int lineNr, MLGray& img, bool lazy, bool cache, RowTiming* timing = nullptr) {
+	RowTiming t;
+	double* ms[SAVE + 1] = { &t.read, &t.preprocess, &t.halftoning, &t.postprocess, &t.save };
+	auto last = chrono::steady_clock::now();
+	auto lap = [&last](double& ms) {
+		auto now = chrono::steady_clock::now();
+		ms += chrono::duration<double, milli>(now - last).count();
+		last = now;
+	};
+	Row row;
+	if (!ParseRow(line, lineNr, row)) { return false; }
+	t.cached = cache && UpToDate(row);
+	for (int stage = READ; (stage <= SAVE) && !t.cached; stage++) {
+		if (!RunStage(stage, row, img, lazy)) { return false; }
+		lap(*ms[stage]);
+	}
+	if (t.cached) { lap(t.read); }
+	if (timing != nullptr) { *timing = t; }
+	return true;
 }
 
 /**
-<summary> Parses the 5th column of the *.csv file. This specifies the post-processing step.</summary>
-<param name="op">The operation. E.g. SaltPepper.</param>
-<param name="img">The image which will be post-processed.</param>
-<returns> true if operation is valid. Otherwise false</returns>
+<summary>Performs the actions of a command file. The lines are merged by the Planner, so the stages which are
+common to several lines are performed only once. The inputs are read ahead and the outputs are written behind on
+separate threads. If several lines write the same output, only the last one is performed, its image is the one which
+remains.</summary>
+<param name="cmdFile">The opened command file.</param>
+<param name="lazy">true if the filters are fused. See MLGray::SetLazy().</param>
+<param name="cache">true if the lines with an up to date output are skipped. See ResultCache.</param>
+<param name="report">The file of the timing report, see WriteReport(). Empty if the stages are not measured.</param>
 */
-bool Postprocess(string op, MLGray& img) {
-	if (op.empty()) { return false; }
-	op.erase(remove(op.begin(), op.end(), ' '), op.end());
-	int p1,p2;
-	
-	if (op.find("SaltPepper") == 0) {
-		if (Param(op, p1)) { return img.SaltPepper(p1); }
-		return img.SaltPepper();
-	}
-	if (op.find("Gauss5") == 0) {
-		return img.Gauss55Filter();
-	}
-	if (op.find("Gauss7") == 0) {
-		return img.Gauss77Filter();
-	}
-	if (op.find("Majority") == 0) {
-		return img.Majority();
-	}
-	if (op.find("Invert") == 0) {
-		return img.Invert();
-	}
-	if (op.find("GameOfLife") == 0) {
-		if (Param2(op, p1,p2)) {
-			bool whiteAlive=(p1!=0);
-			return img.GameOfLife(whiteAlive,p2); 
+void RunPlan(istream& cmdFile, bool lazy, bool cache, const string& report) {
+	map<int, Row> rows;
+	map<string, int> outputLine;  // The last line which writes an output
+	Planner plan;
+	string line;
+	int errors = 0;
+	// All lines are parsed and checked before the first image is read
+	for (int lineNr = 1; getline(cmdFile, line); lineNr++) {
+		if (line.empty()) { continue; }
+		if (line[0] == '#') { continue; } // Comment Line
+		Row row;
+		if (!ParseRow(line, lineNr, row)) {
+			errors++;
+			continue;
+		}
+		// The lines are not finished in file order (see Planner). As in file order the last line which writes an
+		// output wins, the earlier ones are skipped.
+		auto w = outputLine.find(row.output);
+		if (w != outputLine.end()) {
+			Diagnostic(w->second, row.output + " is written again by line " + to_string(lineNr) + ", skipped");
+			rows.erase(w->second);
 		}
-		return img.GameOfLife();
+		outputLine[row.output] = lineNr;
+		rows[lineNr] = row;
 	}
-	cout << "WARNING: Unknown Postprocessing operation " << op << endl;
-	return false; 
+	for (auto r = rows.begin(); r != rows.end();) {
+		if (cache && UpToDate(r->second)) {
+			r = rows.erase(r);
+			continue;
+		}
+		vector<string> keys;
+		for (int stage = READ; stage <= POSTPROCESS; stage++) { keys.push_back(r->second.StageKey(stage)); }
+		plan.Add(r->first, keys);
+		++r;
+	}
+	if (errors > 0) { cout << errors << " lines with errors are skipped" << endl; }
+	cout << "Plan: " << plan.Lines() << " lines, " << plan.Stages() << " of " << SAVE * plan.Lines() << " stages" << endl;
+	// Three threads work in a pipeline: the inputs are read and converted ahead, the outputs are encoded and
+	// written behind the computation. The queues hold at most QueueSize images each. The reader and the writer are
+	// started before this thread measures its first stage, so they do not inherit its performance counters.
+	const size_t QueueSize = 2;
+	struct Item {
+		int lineNr = 0;
+		bool ok = false;
+		MLGray img;
+	};
+	BoundedQueue<Item> inputs(QueueSize);
+	BoundedQueue<Item> outputs(QueueSize);
+	// The entries are created up front, so the threads only touch their own stages
+	map<int, RowStats> stats;
+	if (!report.empty()) {
+		for (const auto& r : rows) { stats[r.first]; }
+	}
+	auto statsOf = [&stats, &report](int stage, int lineNr) {
+		return report.empty() ? nullptr : &stats.at(lineNr).stage[stage];
+	};
+	vector<int> first = plan.FirstStages();
+	Trace::ThreadName("Compute");
+	thread reader([&] {
+		Trace::ThreadName("Reader");
+		for (int lineNr : first) {
+			Item item;
+			item.lineNr = lineNr;
+			item.img.SetLazy(lazy);
+			item.ok = MeasureStage(READ, rows.at(lineNr), item.img, lazy, statsOf(READ, lineNr));
+			if (!inputs.Push(move(item))) { break; }
+		}
+		inputs.Close();
+	});
+	thread writer([&] {
+		Trace::ThreadName("Writer");
+		Item item;
+		while (outputs.Pop(item)) {
+			MeasureStage(SAVE, rows.at(item.lineNr), item.img, lazy, statsOf(SAVE, item.lineNr));
+			item.img = MLGray();
+		}
+	});
+	plan.Run([&](int stage, int lineNr, MLGray& img, bool last) {
+		const Row& row = rows.at(lineNr);
+		if (stage == READ) {
+			Item item;
+			if (!inputs.Pop(item)) { return false; }
+			img = move(item.img);
+			return item.ok;
+		}
+		if (stage == SAVE) {
+			cout << row.line << endl;
+			Item item;
+			item.lineNr = lineNr;
+			item.img = last ? move(img) : img.Clone();  // Other lines may still finish with img
+			outputs.Push(move(item));
+			return true;
+		}
+		return MeasureStage(stage, row, img, lazy, statsOf(stage, lineNr));
+	});
+	outputs.Close();
+	inputs.Close();
+	reader.join();
+	writer.join();
+	if (!report.empty()) { WriteReport(report, rows, stats); }
 }
 
 /**
-<summary> Saves the image as *.JPG in RGB format in a file.</summary>
-<param name="fName">The fName of the image. Without the extension ".JPG". The file will be stored
-in the subdirectory ./result Example: Trini_GIMP_FloydSteinberg.</param>
-<returns> true if file can be saved. Otherwise false</returns>
+<summary>Runs MonaLena as a server. See main().</summary>
+<returns>0 if the server terminated normally, otherwise 1</returns>
 */
-bool SaveImage(string fName,MLGray &img) {
-	if (fName.empty()) { return false; }
-	string fileName = "./result/" + fName + ".jpg";
-	img.SaveImage(fileName);
-	return true;
+int RunServer(int workers, bool lazy, bool cache, const string& socketPath) {
+	if (workers <= 0) { workers = Parallel::Threads(); }
+	// The workers process different images, the operations of one image use the remaining threads
+	int inner = Parallel::Threads() / workers;
+	Parallel::SetThreads((inner > 1) ? inner : 1);
+	BlueNoiseMask();  // Builds the static table before the first job
+	vector<MLGray> img(workers);
+	for (auto& i : img) { i.SetLazy(lazy); }
+	Server server(workers, [&img, lazy, cache](int worker, int lineNr, const string& line) {
+		RowTiming t;
+		auto start = chrono::steady_clock::now();
+		bool ok = ProcessRow(line, lineNr, img[worker], lazy, cache, &t);
+		double total = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		istringstream s(line);
+		string output[6];
+		for (int n = 0; (n <= 5) && (getline(s, output[n], ',')); n++) {}
+		ostringstream r;
+		r << fixed << setprecision(3) << ((!ok) ? "failed," : (t.cached) ? "cached," : "ok,") << output[5] << ","
+			<< t.read << "," << t.preprocess << "," << t.halftoning << "," << t.postprocess << "," << t.save << "," << total;
+		return r.str();
+	});
+	if (socketPath.empty()) { return server.RunStdin(); }
+	return server.RunSocket(socketPath);
 }
 
 /**
-<summary>Call with MonaLena <cmdFile>. e.g. MonaLena trini. Reads the commands in
-trini.csv and performs the specified actions. The name of the command file must be without the *.csv extension.
+<summary>Call with MonaLena <cmdFile> [-lazy] [-cache] [-report file [-counters]] [-trace file]. e.g. MonaLena trini.
+Reads the commands in trini.csv and performs the specified actions. The name of the command file must be without the *.csv extension.
 If the command parameter is missing, the cmdFile "cmd.csv" is assumed.
+Lines which share the input, converter, region, preprocessing or halftoning share their computation, see Planner.
+With the option -lazy the pre- and postprocessing filters are fused into a single pass (see MLGray::SetLazy()).
+The input image can be synthetic, e.g. @gradient:16384:16384, @radial:w:h, @noise:seed:w:h, @checker:size:w:h or
+@color:seed:w:h. It is computed in memory at any size, so runs can be scaled without image files (see Synthetic).
+An optional 7th column Roi:x:y:w:h restricts the pre-, halftoning and postprocessing to this rectangle of the image.
+The rest of the image keeps its gray values. See MLGray::View().
+An optional column Preview:n (after the region, if any) renders a preview at 1/n of the size, n = 2, 4 or 8. A JPEG
+input is decoded at the reduced size from its DCT coefficients, which costs a fraction of a full decode (see
+JpegReader). The region is given in the coordinates of the full size image.
+With the option -cache a line is skipped if its output image exists and was computed from the same input image with
+the same pipeline and library version (see ResultCache).
+With the option -report every stage of every line is timed: decode, gray conversion, preprocessing, halftoning,
+postprocessing and save, with the processed pixels and the memory requested from the Arena. The stages are written
+to file (CSV, or JSON for *.json), a summary per operation is written to file_summary.csv and to stdout. A stage which
+is shared by several lines is reported for the first one. Without -report nothing is measured.
+With -counters the report has the hardware performance counters of the stages (Linux only, see PerfCounters):
+cycles, instructions, last level cache misses, branches and branch misses, summarized as IPC, LLC misses per pixel
+and branch miss rate.
+With the option -trace, or if the environment variable MONALENA_TRACE names a file, the stages, the operations, the
+decoding, encoding and the blocks of Parallel::For() are recorded per thread and written to file as Chrome trace JSON
+(see Trace). Open it with chrome://tracing or https://ui.perfetto.dev.
+
+MonaLena -server [-lazy] [-cache] [-workers n] [-socket path] [-trace file] runs as a daemon. The command lines are read from stdin or, with
+-socket, from the clients of a Unix-domain socket. They are processed by n worker threads (default: one per hardware
+thread). For each command line a completion record is written to stdout or back to the client:
+lineNr,ok|cached|failed,outputImage,read,preprocess,halftoning,postprocess,save,total
+The times are in ms. In lazy mode the fused filters are counted in the stage which materializes the image. A line is
+failed if it is invalid, its input can not be converted or its output can not be written; the reason is written to
+stderr.
 <returns>0 if batch operations are successfull, otherwise 1</returns>
 </summary>
 */
 int main(int argc, char* argv[])
 {
 	string cmdFile = "cmd";
-	if (argc >= 1) { cmdFile = argv[1]; }
+	if (argc >= 2) { cmdFile = argv[1]; }
+	bool server = (cmdFile == "-server");
+	bool lazy = false;
+	bool cache = false;
+	int workers = 0;
+	string socketPath;
+	string report;
+	string trace;
+	bool counters = false;
+#ifdef _MSC_VER
+	char* env = nullptr;
+	size_t envSize = 0;
+	if ((_dupenv_s(&env, &envSize, "MONALENA_TRACE") == 0) && (env != nullptr)) {
+		trace = env;
+		free(env);
+	}
+#else
+	if (const char* env = getenv("MONALENA_TRACE")) { trace = env; }
+#endif
+	for (int n = 2; n < argc; n++) {
+		string arg = argv[n];
+		if (arg == "-lazy") { lazy = true; }
+		if (arg == "-cache") { cache = true; }
+		if ((arg == "-workers") && (n + 1 < argc)) { workers = atoi(argv[++n]); }
+		if ((arg == "-socket") && (n + 1 < argc)) { socketPath = argv[++n]; }
+		if ((arg == "-report") && (n + 1 < argc)) { report = argv[++n]; }
+		if ((arg == "-trace") && (n + 1 < argc)) { trace = argv[++n]; }
+		if (arg == "-counters") { counters = true; }
+	}
+	const char* message = nullptr;
+	if (counters && !report.empty() && !PerfCounters::Enable(&message)) {
+		cout << "No performance counters: " << message << endl;
+	}
+	if (!trace.empty()) { Trace::Start(); }
+	auto writeTrace = [&trace]() {
+		if (!trace.empty() && !Trace::Write(trace)) { cout << "Can not write trace " << trace << endl; }
+	};
+	if (server) {
+		int result = RunServer(workers, lazy, cache, socketPath);
+		writeTrace();
+		return result;
+	}
 	cmdFile += ".csv";
-	string line;
 	ifstream myfile(cmdFile);
-	string fileName;
-	MLGray img;
-	
 	if (myfile.is_open())
 	{
-		for (int lineNr = 1;getline(myfile, line);lineNr++)
-		{
-
-			if (line.empty()) { continue; }
-			if (line[0] == '#') { continue; } // Comment Line
-			cout << line << endl;
-			istringstream s(line);
-			string field;
-			for (int n = 0;(n<=5)&&(getline(s, field, ','));n++) {
-				if(n==0) {
-					if(field.empty()) { 
-						cout << "Line "<<lineNr<<": Missing input FileName" << endl;
-						break;
-					}
-					fileName="./image/"+field+".jpg"; 
-				}
-				if (n == 1) {
-					if (!ConvertToGray(fileName, field, img)) {
-						cout << "Line " << lineNr << ": Can not convert " << fileName << "with " << field << endl;
-						break;
-					}
-				}
-				if (n == 2) {
-					Preprocess(field, img);
-				}
-				if (n == 3) {
-					Halftoning(field, img);
-				}
-				if (n == 4) {
-					Postprocess(field, img);
-				}
-				if (n == 5) {
-					SaveImage(field,img);
-
-				}
-			}
-		}
+		RunPlan(myfile, lazy, cache, report);
 		myfile.close();
+		writeTrace();
 		return 0;
 	}
 	else {
@@ -0,0 +1,359 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Arena.h"
+#include "Command.h"
+#include "MLGray.h"
+#include "Parallel.h"
+#include "PerfCounters.h"
+#include "Synthetic.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+using namespace std;
+namespace fs = std::filesystem;
+
+/**
+<summary>The settings of a benchmark run.</summary>
+*/
+struct Options {
+	string images = "./Image/";
+	vector<double> sizes = { 0.25, 1.0, 4.0, 16.0, 100.0 };  // The synthetic images in megapixels
+	int warmup = 1;
+	int repetitions = 5;
+	int threads = 0;  // See Parallel::SetThreads()
+	string filter;  // Only the cases whose name contains filter are run
+	string output;  // The JSON file. Empty for stdout
+	string baseline;  // The JSON file of a previous run
+	double threshold = 5.0;  // A case is a regression if its ns/pixel is larger than in the baseline by more percent
+	bool counters = false;  // Reports the hardware performance counters, see PerfCounters
+};
+
+/**
+<summary>An input image of the benchmark: a file of the corpus or a synthetic image.</summary>
+*/
+struct Input {
+	string name;  // e.g. Lena or 4MP
+	fs::path file;  // The file of the corpus, empty for a synthetic image
+	string spec;  // The gray noise of a synthetic input for the operations after the converter, see Synthetic
+	string colorSpec;  // The color image of a synthetic input for the converters
+	vector<unsigned char> jpg;  // The encoded color image of the file for the converters
+	MLGray gray;  // The GIMP conversion for the other operations
+};
+
+/**
+<summary>The measurement of an operation on an input image.</summary>
+*/
+struct Result {
+	string name;  // column/operation/input, e.g. Halftoning/FloydSteinberg/Lena
+	int width = 0;
+	int height = 0;
+	double medianMs = 0.0;
+	double minMs = 0.0;
+	double arenaAllocations = 0.0;  // Heap allocations of the Arena pool per run after the warmup. Not the other heap
+	long long processPeakRssKB = 0;  // Peak resident set size of the process so far. It never drops between cases
+	double baseline = -1.0;  // ns/pixel of the baseline, negative if the case is not in the baseline
+	PerfCounters::Sample counters;  // The sum over the repetitions
+
+	double MpixPerS() const { return (medianMs > 0.0) ? (double)width * height / (medianMs * 1000.0) : 0.0; }
+	double NsPerPixel() const { return medianMs * 1.0e6 / ((double)width * height); }
+	double Change() const { return (baseline > 0.0) ? (NsPerPixel() / baseline - 1.0) * 100.0 : 0.0; }
+	double PerPixel(uint64_t count, int repetitions) const { return (double)count / ((double)width * height * repetitions); }
+};
+
+const char* ColumnName[] = { "Converter", "Preprocess", "Halftoning", "Postprocess" };
+
+/**
+<returns>The parameters of the operations which have no defaults.</returns>
+*/
+string RequiredParams(const string& op) {
+	if (op == "Saturate") { return ":0.299:0.587:0.114"; }
+	return "";
+}
+
+/**
+<returns>The peak resident set size of the process in KB.</returns>
+*/
+long long PeakRssKB() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) { return 0; }
+	return (long long)(pmc.PeakWorkingSetSize / 1024);
+#else
+	struct rusage u;
+	if (getrusage(RUSAGE_SELF, &u) != 0) { return 0; }
+#ifdef __APPLE__
+	return (long long)u.ru_maxrss / 1024;  // bytes
+#else
+	return (long long)u.ru_maxrss;
+#endif
+#endif
+}
+
+/**
+<returns>The Synthetic spec of a pattern with a seed (noise or color) with about mpix megapixels in 4:3 format. The
+image is computed in memory and is the same in every run.</returns>
+*/
+string SyntheticSpec(const string& pattern, double mpix) {
+	int w = max((int)lround(sqrt(mpix * 1.0e6 * 4.0 / 3.0)), 8);
+	int h = max((int)lround(w * 3.0 / 4.0), 8);
+	return "@" + pattern + ":4711:" + to_string(w) + ":" + to_string(h);
+}
+
+/**
+<summary>Lists the *.jpg files of the directory. The files are sorted by name, they are read by Load().</summary>
+*/
+vector<unique_ptr<Input>> Corpus(const string& dir) {
+	vector<fs::path> files;
+	error_code ec;
+	for (const fs::directory_entry& e : fs::directory_iterator(dir, ec)) {
+		string ext = e.path().extension().string();
+		transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower(c); });
+		if ((ext == ".jpg") || (ext == ".jpeg")) { files.push_back(e.path()); }
+	}
+	sort(files.begin(), files.end());
+	vector<unique_ptr<Input>> inputs;
+	for (const fs::path& f : files) {
+		unique_ptr<Input> in(new Input());
+		in->name = f.stem().string();
+		in->file = f;
+		inputs.push_back(move(in));
+	}
+	return inputs;
+}
+
+/**
+<returns>The source of the converters: the JPEG in memory or the synthetic color image. Both have three channels,
+so the converters do the RGB conversion they are named for.</returns>
+*/
+MLSource Source(const Input& in) {
+	return in.file.empty() ? MLSource(in.colorSpec) : MLSource(in.jpg.data(), in.jpg.size());
+}
+
+/**
+<summary>Reads the file and converts it to gray, or creates the gray noise of a synthetic input.</summary>
+<returns>false if the image can not be decoded.</returns>
+*/
+bool Load(Input& in) {
+	if (!in.file.empty()) {
+		ifstream s(in.file, ios::binary);
+		in.jpg.assign(istreambuf_iterator<char>(s), istreambuf_iterator<char>());
+		return in.gray.SaturateGIMP(Source(in));
+	}
+	return in.gray.SaturateGIMP(MLSource(in.spec));
+}
+
+/**
+<summary>Runs an operation warmup + repetitions times. The gray image is copied before every run, outside of the
+measured time. A converter starts with an empty image and decodes the JPEG or generates the synthetic color image.</summary>
+*/
+Result Measure(const Command& cmd, bool converter, const string& name, Input& in, const Options& opt) {
+	Result r;
+	r.name = name;
+	vector<double> ms;
+	size_t allocations = 0;
+	r.counters.valid = PerfCounters::Enabled();
+	for (int i = 0; i < opt.warmup + opt.repetitions; i++) {
+		MLGray img = converter ? MLGray() : in.gray.Clone();
+		MLSource src = Source(in);
+		size_t heap = Arena::HeapAllocations();
+		PerfCounters::Sample counters = PerfCounters::Read();
+		auto start = chrono::steady_clock::now();
+		cmd.Run(img, src);
+		double t = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (i < opt.warmup) { continue; }
+		r.counters += PerfCounters::Read() - counters;
+		allocations += Arena::HeapAllocations() - heap;
+		ms.push_back(t);
+		r.width = img.GetWidth();
+		r.height = img.GetHeight();
+	}
+	sort(ms.begin(), ms.end());
+	r.medianMs = (ms.size() % 2 == 1) ? ms[ms.size() / 2] : (ms[ms.size() / 2 - 1] + ms[ms.size() / 2]) / 2.0;
+	r.minMs = ms.front();
+	r.arenaAllocations = (double)allocations / opt.repetitions;
+	r.processPeakRssKB = PeakRssKB();
+	return r;
+}
+
+/**
+<summary>Reads ns/pixel of the cases of a JSON file written by this program. The file is not parsed as general
+JSON, the results are expected one per line.</summary>
+*/
+map<string, double> ReadBaseline(const string& fileName) {
+	map<string, double> baseline;
+	ifstream s(fileName);
+	string line;
+	const string nameTag = "\"name\": \"";
+	const string nsTag = "\"nsPerPixel\": ";
+	while (getline(s, line)) {
+		size_t n = line.find(nameTag);
+		size_t ns = line.find(nsTag);
+		if ((n == string::npos) || (ns == string::npos)) { continue; }
+		n += nameTag.size();
+		baseline[line.substr(n, line.find('"', n) - n)] = atof(line.c_str() + ns + nsTag.size());
+	}
+	return baseline;
+}
+
+void WriteJson(ostream& o, const vector<Result>& results, const Options& opt) {
+	o << "{" << endl;
+	o << "  \"threads\": " << Parallel::Threads() << "," << endl;
+	o << "  \"warmup\": " << opt.warmup << "," << endl;
+	o << "  \"repetitions\": " << opt.repetitions << "," << endl;
+	o << "  \"results\": [" << endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		o << "    { \"name\": \"" << r.name << "\", \"width\": " << r.width << ", \"height\": " << r.height
+			<< ", \"medianMs\": " << r.medianMs << ", \"minMs\": " << r.minMs << ", \"mpixPerS\": " << r.MpixPerS()
+			<< ", \"nsPerPixel\": " << r.NsPerPixel() << ", \"arenaAllocations\": " << r.arenaAllocations
+			<< ", \"processPeakRssKB\": " << r.processPeakRssKB;
+		if (r.counters.valid) {
+			o << ", \"ipc\": " << r.counters.Ipc() << ", \"cyclesPerPixel\": " << r.PerPixel(r.counters.cycles, opt.repetitions)
+				<< ", \"llcMissesPerPixel\": " << r.PerPixel(r.counters.llcMisses, opt.repetitions)
+				<< ", \"branchMissRate\": " << r.counters.BranchMissRate();
+		}
+		if (r.baseline > 0.0) {
+			o << ", \"baselineNsPerPixel\": " << r.baseline << ", \"changePercent\": " << r.Change()
+				<< ", \"regression\": " << ((r.Change() > opt.threshold) ? "true" : "false");
+		}
+		o << " }" << ((i + 1 < results.size()) ? "," : "") << endl;
+	}
+	o << "  ]" << endl;
+	o << "}" << endl;
+}
+
+vector<double> ParseSizes(const string& list) {
+	vector<double> sizes;
+	istringstream s(list);
+	string v;
+	while (getline(s, v, ',')) {
+		double m = atof(v.c_str());
+		if (m > 0.0) { sizes.push_back(m); }
+	}
+	return sizes;
+}
+
+/**
+<summary>Call with MonaLenaBench [-images dir] [-sizes 0.25,1,4,16,100] [-warmup n] [-repetitions n] [-threads n]
+[-filter text] [-o result.json] [-baseline old.json] [-threshold percent] [-counters].
+Measures every operation of the command file registry (see Command) on the *.jpg images in dir (default ./Image/)
+and on synthetic images with the given sizes in megapixels (see Synthetic). The converters decode the JPEG from
+memory, for a synthetic size they generate a color image (@color) and convert it. The other operations work on the
+GIMP conversion of the image, for a synthetic size on gray noise (@noise). Each case is run warmup times, then
+repetitions times; the median time is reported as Mpix/s and ns/pixel, with the heap allocations of the Arena pool
+per run (arenaAllocations, other heap allocations are not counted) and the peak RSS of the process so far
+(processPeakRssKB). The peak RSS only grows, it belongs to the largest case run up to then, not to this case.
+The results are written as JSON, one case per line, so two runs can be diffed. With -baseline the cases are compared
+to an earlier run: a case whose ns/pixel grew by more than threshold percent (default 5) is flagged as regression.
+-filter restricts the run to the cases whose name (column/operation/input) contains text, e.g. -filter Halftoning/.
+-counters adds the hardware performance counters of the repetitions (Linux only, see PerfCounters): the IPC, the
+cycles and last level cache misses per pixel and the branch miss rate.
+<returns>0 if no regression was found, otherwise 1</returns>
+</summary>
+*/
+int main(int argc, char* argv[])
+{
+	Options opt;
+	for (int n = 1; n < argc; n++) {
+		string arg = argv[n];
+		if (arg == "-counters") { opt.counters = true; }
+		if (n + 1 >= argc) { break; }
+		if (arg == "-images") { opt.images = argv[++n]; }
+		if (arg == "-sizes") { opt.sizes = ParseSizes(argv[++n]); }
+		if (arg == "-warmup") { opt.warmup = max(atoi(argv[++n]), 0); }
+		if (arg == "-repetitions") { opt.repetitions = max(atoi(argv[++n]), 1); }
+		if (arg == "-threads") { opt.threads = atoi(argv[++n]); }
+		if (arg == "-filter") { opt.filter = argv[++n]; }
+		if (arg == "-o") { opt.output = argv[++n]; }
+		if (arg == "-baseline") { opt.baseline = argv[++n]; }
+		if (arg == "-threshold") { opt.threshold = atof(argv[++n]); }
+	}
+	Parallel::SetThreads(opt.threads);
+	const char* message = nullptr;
+	if (opt.counters && !PerfCounters::Enable(&message)) { cerr << "No performance counters: " << message << endl; }
+	vector<unique_ptr<Input>> inputs = Corpus(opt.images);
+	for (double mpix : opt.sizes) {
+		unique_ptr<Input> in(new Input());
+		ostringstream name;
+		name << mpix << "MP";
+		in->name = name.str();
+		in->spec = SyntheticSpec("noise", mpix);
+		in->colorSpec = SyntheticSpec("color", mpix);
+		inputs.push_back(move(in));
+	}
+	int count;
+	const Command::Op* ops = Command::Operations(count);
+	auto caseName = [ops](int i, const Input& in) {
+		return string(ColumnName[ops[i].column]) + "/" + ops[i].name + "/" + in.name;
+	};
+	vector<Result> results;
+	for (unique_ptr<Input>& in : inputs) {
+		bool selected = false;
+		for (int i = 0; i < count; i++) { selected |= (caseName(i, *in).find(opt.filter) != string::npos); }
+		if (!selected) { continue; }
+		if (!Load(*in)) {
+			cerr << "Can not decode " << in->name << endl;
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			string name = caseName(i, *in);
+			if (name.find(opt.filter) == string::npos) { continue; }
+			Command cmd;
+			string error;
+			if (!cmd.Parse(ops[i].column, ops[i].name + RequiredParams(ops[i].name), error)) {
+				cerr << error << endl;
+				continue;
+			}
+			results.push_back(Measure(cmd, ops[i].column == Command::CONVERTER, name, *in, opt));
+			cerr << name << ": " << results.back().medianMs << " ms" << endl;
+		}
+		MLGray empty;
+		in->gray.Swap(empty);  // The images are not needed anymore
+		vector<unsigned char>().swap(in->jpg);
+	}
+
+	bool regression = false;
+	if (!opt.baseline.empty()) {
+		map<string, double> baseline = ReadBaseline(opt.baseline);
+		for (Result& r : results) {
+			auto b = baseline.find(r.name);
+			if (b == baseline.end()) { continue; }
+			r.baseline = b->second;
+			if (r.Change() > opt.threshold) {
+				cerr << "Regression " << r.name << ": " << r.NsPerPixel() << " ns/pixel, baseline " << r.baseline
+					<< " (+" << r.Change() << "%)" << endl;
+				regression = true;
+			}
+		}
+	}
+	if (opt.output.empty()) {
+		WriteJson(cout, results, opt);
+	}
+	else {
+		ofstream o(opt.output);
+		WriteJson(o, results, opt);
+	}
+	return regression ? 1 : 0;
+}
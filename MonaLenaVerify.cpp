@@ -0,0 +1,447 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Command.h"
+#include "CommandFile.h"
+#include "MLGray.h"
+#include "Parallel.h"
+#include "Synthetic.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+namespace fs = std::filesystem;
+
+/**
+<summary>The settings of a verification run.</summary>
+*/
+struct Options {
+	string images = "./Image/";
+	string commands = ".";  // The directory of the *.csv command files
+	string golden = "golden.txt";
+	string reference;  // The directory of the reference images. Empty if there are none
+	string filter;  // Only the cases whose name contains filter are run
+	bool update = false;  // Writes the golden hashes (and the reference images) instead of comparing
+	bool lazy = false;  // The operations and pipelines run with fused filters, see MLGray::SetLazy()
+	int threads = 0;  // See Parallel::SetThreads()
+};
+
+/**
+<summary>The expected result of a case. A case whose hash differs passes, if the difference to its reference image
+is within the tolerance. A tolerance of 0 requires a bit exact result.</summary>
+*/
+struct Golden {
+	int width = 0;
+	int height = 0;
+	uint64_t hash = 0;
+	double maxDiff = 0.0;  // The largest allowed absolute difference of a pixel
+	double meanDiff = 0.0;  // The largest allowed mean absolute difference
+};
+
+/**
+<summary>The difference of an image to its reference image.</summary>
+*/
+struct Difference {
+	bool valid = false;  // false if there is no reference image of the same size
+	int maxDiff = 0;
+	double meanDiff = 0.0;
+	double differing = 0.0;  // The fraction of the pixels which differ
+};
+
+/**
+<summary>The state of a run: the golden hashes read or collected and the counts of the outcomes.</summary>
+*/
+struct Verifier {
+	Options opt;
+	map<string, Golden> golden;
+	int exact = 0;
+	int approximate = 0;
+	int failed = 0;
+	int missing = 0;  // Cases without a golden hash
+
+	/**
+	<summary>Compares the image of a case with its golden hash or stores it with -update.</summary>
+	*/
+	void Check(const string& name, MLGray& img);
+	/**
+	<summary>With -lazy an operation must keep the lazy mode of the image, e.g. the filters which replace the
+	buffers of the image. Otherwise the filters of the following operations are not fused anymore.</summary>
+	<returns>false if the case failed.</returns>
+	*/
+	bool CheckLazy(const string& name, const MLGray& img) {
+		if (!opt.lazy || img.IsLazy()) { return true; }
+		cout << name << ": FAILED, the lazy mode was lost" << endl;
+		failed++;
+		return false;
+	}
+};
+
+const char* ColumnName[] = { "Converter", "Preprocess", "Halftoning", "Postprocess" };
+const char* StageName[] = { "convert", "preprocess", "halftoning", "postprocess" };
+
+/**
+<returns>The 64 bit FNV-1a hash of the size and the pixels of the image. The ghost border and the padding of the
+lines are not included, so the hash depends only on the gray values.</returns>
+*/
+uint64_t Hash(MLGray& img) {
+	const uint64_t Prime = 0x100000001b3ULL;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int w = img.GetWidth();
+	int ht = img.GetHeight();
+	const int32_t* data = img.GetData();
+	int stride = img.GetStride();
+	h = (h ^ (uint32_t)w) * Prime;
+	h = (h ^ (uint32_t)ht) * Prime;
+	for (int y = 0; y < ht; y++) {
+		const int32_t* p = data + (size_t)y * stride;
+		for (int x = 0; x < w; x++) { h = (h ^ (uint32_t)p[x]) * Prime; }
+	}
+	return h;
+}
+
+/**
+<returns>The file of the reference image of a case. The separators of the name are replaced.</returns>
+*/
+fs::path ReferenceFile(const string& dir, const string& name) {
+	string f = name;
+	replace_if(f.begin(), f.end(), [](char c) { return (c == '/') || (c == ':') || (c == '\\'); }, '_');
+	return fs::path(dir) / (f + ".raw");
+}
+
+/**
+<summary>Writes the pixels as raw image: width and height, then the pixels line by line, all as int32.</summary>
+*/
+void WriteReference(const fs::path& file, MLGray& img) {
+	int32_t size[2] = { img.GetWidth(), img.GetHeight() };
+	ofstream o(file, ios::binary);
+	o.write((const char*)size, sizeof(size));
+	const int32_t* data = img.GetData();
+	for (int y = 0; y < size[1]; y++) {
+		o.write((const char*)(data + (size_t)y * img.GetStride()), size[0] * sizeof(int32_t));
+	}
+}
+
+/**
+<summary>Compares the image with the raw reference image written by WriteReference().</summary>
+*/
+Difference Compare(const fs::path& file, MLGray& img) {
+	Difference d;
+	ifstream s(file, ios::binary);
+	int32_t size[2] = {};
+	if (!s.read((char*)size, sizeof(size)) || (size[0] != img.GetWidth()) || (size[1] != img.GetHeight())) { return d; }
+	vector<int32_t> ref(size[0]);
+	const int32_t* data = img.GetData();
+	double sum = 0.0;
+	long long differing = 0;
+	for (int y = 0; y < size[1]; y++) {
+		if (!s.read((char*)ref.data(), size[0] * sizeof(int32_t))) { return d; }
+		const int32_t* p = data + (size_t)y * img.GetStride();
+		for (int x = 0; x < size[0]; x++) {
+			int diff = abs(p[x] - ref[x]);
+			d.maxDiff = max(d.maxDiff, diff);
+			sum += diff;
+			differing += (diff != 0);
+		}
+	}
+	double n = (double)size[0] * size[1];
+	d.meanDiff = (n > 0.0) ? sum / n : 0.0;
+	d.differing = (n > 0.0) ? differing / n : 0.0;
+	d.valid = true;
+	return d;
+}
+
+void Verifier::Check(const string& name, MLGray& img) {
+	uint64_t hash = Hash(img);
+	if (opt.update) {
+		Golden& g = golden[name];  // An existing tolerance is kept
+		g.width = img.GetWidth();
+		g.height = img.GetHeight();
+		g.hash = hash;
+		if (!opt.reference.empty()) { WriteReference(ReferenceFile(opt.reference, name), img); }
+		cout << name << ": " << hex << setw(16) << setfill('0') << hash << dec << setfill(' ') << endl;
+		return;
+	}
+	auto g = golden.find(name);
+	if (g == golden.end()) {
+		cout << name << ": no golden hash" << endl;
+		missing++;
+		return;
+	}
+	if (hash == g->second.hash) {
+		cout << name << ": exact" << endl;
+		exact++;
+		return;
+	}
+	Difference d;
+	if (!opt.reference.empty()) { d = Compare(ReferenceFile(opt.reference, name), img); }
+	if (!d.valid) {
+		cout << name << ": FAILED, the hash differs";
+		if ((img.GetWidth() != g->second.width) || (img.GetHeight() != g->second.height)) {
+			cout << ", size " << img.GetWidth() << "x" << img.GetHeight() << " instead of " << g->second.width << "x"
+				<< g->second.height;
+		}
+		cout << endl;
+		failed++;
+		return;
+	}
+	bool tolerant = (g->second.maxDiff > 0.0) || (g->second.meanDiff > 0.0);
+	bool ok = tolerant && (d.maxDiff <= g->second.maxDiff) && (d.meanDiff <= g->second.meanDiff);
+	cout << name << ": " << (ok ? "approximate" : "FAILED") << ", max diff " << d.maxDiff << ", mean diff " << fixed
+		<< setprecision(4) << d.meanDiff << ", " << setprecision(2) << d.differing * 100.0 << "% differing pixels"
+		<< defaultfloat << setprecision(6) << endl;
+	(ok ? approximate : failed)++;
+}
+
+/**
+<summary>Reads the golden file. A line is name,width,height,hash[,maxDiff,meanDiff] with the hash in hex.
+Empty lines and lines starting with # are ignored.</summary>
+*/
+map<string, Golden> ReadGolden(const string& fileName) {
+	map<string, Golden> golden;
+	ifstream s(fileName);
+	string line;
+	while (getline(s, line)) {
+		if ((!line.empty()) && (line.back() == '\r')) { line.pop_back(); }
+		if (line.empty() || (line[0] == '#')) { continue; }
+		istringstream l(line);
+		string field[6];
+		for (int n = 0; (n < 6) && getline(l, field[n], ','); n++) {}
+		Golden g;
+		g.width = atoi(field[1].c_str());
+		g.height = atoi(field[2].c_str());
+		g.hash = strtoull(field[3].c_str(), nullptr, 16);
+		g.maxDiff = atof(field[4].c_str());
+		g.meanDiff = atof(field[5].c_str());
+		golden[field[0]] = g;
+	}
+	return golden;
+}
+
+bool WriteGolden(const string& fileName, const map<string, Golden>& golden) {
+	ofstream o(fileName);
+	o << "# MonaLenaVerify golden hashes: name,width,height,hash[,maxDiff,meanDiff]" << endl;
+	for (const auto& g : golden) {
+		o << g.first << "," << g.second.width << "," << g.second.height << "," << hex << setw(16) << setfill('0')
+			<< g.second.hash << dec << setfill(' ');
+		if ((g.second.maxDiff > 0.0) || (g.second.meanDiff > 0.0)) { o << "," << g.second.maxDiff << "," << g.second.meanDiff; }
+		o << endl;
+	}
+	return (bool)o;
+}
+
+/**
+<returns>The files of the directory with the extension, sorted by name.</returns>
+*/
+vector<fs::path> Files(const string& dir, const string& extension) {
+	vector<fs::path> files;
+	error_code ec;
+	for (const fs::directory_entry& e : fs::directory_iterator(dir, ec)) {
+		string ext = e.path().extension().string();
+		transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower(c); });
+		if (ext == extension) { files.push_back(e.path()); }
+	}
+	sort(files.begin(), files.end());
+	return files;
+}
+
+/**
+<returns>The *.jpg file of an input of a command file. The command files were written on Windows, the case of the
+name may differ from the file, e.g. House and house.jpg.</returns>
+*/
+fs::path ImageFile(const string& dir, const string& name) {
+	fs::path file = fs::path(dir) / (name + ".jpg");
+	if (fs::exists(file)) { return file; }
+	string lower = name + ".jpg";
+	transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return (char)tolower(c); });
+	for (const fs::path& f : Files(dir, ".jpg")) {
+		string n = f.filename().string();
+		transform(n.begin(), n.end(), n.begin(), [](char c) { return (char)tolower(c); });
+		if (n == lower) { return f; }
+	}
+	return file;
+}
+
+/**
+<summary>Runs every operation of the registry (see Command) and MLGray::LaplaceFilter() with the default
+parameters on an input. The converters read the file, the other operations work on a copy of gray.</summary>
+<param name="input">The name of the input in the case names.</param>
+<param name="file">The JPEG file. Empty for a synthetic input, which has no converter cases.</param>
+*/
+void VerifyOperations(Verifier& v, const string& input, const fs::path& file, MLGray& gray) {
+	int count;
+	const Command::Op* ops = Command::Operations(count);
+	for (int i = 0; i < count; i++) {
+		string name = string("op/") + ColumnName[ops[i].column] + "/" + ops[i].name + "/" + input;
+		if (name.find(v.opt.filter) == string::npos) { continue; }
+		bool converter = (ops[i].column == Command::CONVERTER);
+		if (converter && file.empty()) { continue; }
+		string params = (string(ops[i].name) == "Saturate") ? ":0.299:0.587:0.114" : "";  // Has no defaults
+		Command cmd;
+		string error;
+		if (!cmd.Parse(ops[i].column, ops[i].name + params, error)) {
+			cout << name << ": " << error << endl;
+			v.failed++;
+			continue;
+		}
+		MLGray img = converter ? MLGray() : gray.Clone();
+		img.SetLazy(v.opt.lazy);
+		if (!cmd.Run(img, MLSource(file.string())) && converter) {
+			cout << name << ": FAILED, can not convert " << file.string() << endl;
+			v.failed++;
+			continue;
+		}
+		if (!v.CheckLazy(name, img)) { continue; }
+		v.Check(name, img);
+	}
+	// Not in the registry. It replaces the buffers of the image, also in lazy mode.
+	string name = "op/Preprocess/LaplaceFilter/" + input;
+	if (name.find(v.opt.filter) != string::npos) {
+		MLGray img = gray.Clone();
+		img.SetLazy(v.opt.lazy);
+		img.LaplaceFilter();
+		if (v.CheckLazy(name, img)) { v.Check(name, img); }
+	}
+}
+
+/**
+<summary>Runs the lines of a command file and checks the image after each stage. The lines are parsed and performed
+by ParseRow() and RunStage() as in MonaLena, the inputs are taken from the images dir. Lines which do not parse
+(e.g. the header) are skipped. With -lazy only the result of a line is checked, the intermediate images would
+stop the fusion of the filters.</summary>
+*/
+void VerifyCommands(Verifier& v, const fs::path& cmdFile) {
+	ifstream s(cmdFile);
+	string line;
+	for (int lineNr = 1; getline(s, line); lineNr++) {
+		if ((!line.empty()) && (line.back() == '\r')) { line.pop_back(); }
+		if (line.empty() || (line[0] == '#')) { continue; }
+		string prefix = "csv/" + cmdFile.filename().string() + ":" + to_string(lineNr) + "/";
+		if ((prefix + "postprocess").find(v.opt.filter) == string::npos) { continue; }
+		Row row;
+		if (!ParseRow(line, lineNr, row, false)) { continue; }
+		if (!Synthetic::IsSpec(row.input)) { row.input = ImageFile(v.opt.images, fs::path(row.input).stem().string()).string(); }
+		MLGray img;
+		img.SetLazy(v.opt.lazy);
+		if (!RunStage(READ, row, img, v.opt.lazy)) {
+			cout << prefix << StageName[READ] << ": FAILED, can not convert " << row.input << endl;
+			v.failed++;
+			continue;
+		}
+		if (!v.opt.lazy) { v.Check(prefix + StageName[READ], img); }
+		for (int c = PREPROCESS; c <= POSTPROCESS; c++) {
+			RunStage(c, row, img, v.opt.lazy);
+			if (!v.CheckLazy(prefix + StageName[c], img)) { break; }
+			if (!v.opt.lazy || (c == POSTPROCESS)) { v.Check(prefix + StageName[c], img); }
+		}
+	}
+}
+
+/**
+<summary>Call with MonaLenaVerify [-images dir] [-commands dir] [-golden file] [-reference dir] [-filter text]
+[-threads n] [-lazy] [-update].
+Checks that the optimized kernels compute the same images as before. Every operation of the registry (see Command)
+runs on the *.jpg images in dir (default ./Image/) and on the synthetic gradients (MLGray::LinearGradient(),
+MLGray::RadialGradient()). The generators of Synthetic are checked at full size and as preview. Every line of the
+*.csv command files in the commands dir (default .) runs through its pipeline. The pixels after each operation and
+pipeline stage are hashed and compared with the golden hashes in file (default golden.txt), which is under version
+control.
+A case passes if its hash is equal (bit exact). For kernels which are approximate on purpose, the golden file
+gives a tolerance per case: the largest absolute and mean absolute difference of a pixel. Such a case passes if
+its difference to the reference image in the reference dir is within the tolerance; the difference is reported.
+Run it with different -threads and with -lazy to check the parallel and fused variants against the same hashes.
+With -lazy every operation must also keep the lazy mode of the image.
+-update writes the golden file instead of comparing (the tolerances are kept) and with -reference the reference
+images. Update only on purpose, after the changed results were checked. The reference images of all cases need
+several GB; with -filter only the selected cases are updated, e.g. those of an approximate kernel.
+The hashes are computed on x64. The C runtimes may round the transcendental functions differently, so a few cases
+can differ on another platform.
+<returns>0 if all cases passed, otherwise 1</returns>
+</summary>
+*/
+int main(int argc, char* argv[])
+{
+	Verifier v;
+	for (int n = 1; n < argc; n++) {
+		string arg = argv[n];
+		if (arg == "-update") { v.opt.update = true; }
+		if (arg == "-lazy") { v.opt.lazy = true; }
+		if (n + 1 >= argc) { break; }
+		if (arg == "-images") { v.opt.images = argv[++n]; }
+		if (arg == "-commands") { v.opt.commands = argv[++n]; }
+		if (arg == "-golden") { v.opt.golden = argv[++n]; }
+		if (arg == "-reference") { v.opt.reference = argv[++n]; }
+		if (arg == "-filter") { v.opt.filter = argv[++n]; }
+		if (arg == "-threads") { v.opt.threads = atoi(argv[++n]); }
+	}
+	Parallel::SetThreads(v.opt.threads);
+	v.golden = ReadGolden(v.opt.golden);
+	if (v.opt.update && !v.opt.reference.empty()) {
+		error_code ec;
+		fs::create_directories(v.opt.reference, ec);
+	}
+
+	for (const fs::path& file : Files(v.opt.images, ".jpg")) {
+		MLGray gray;
+		if (!gray.SaturateGIMP(MLSource(file.string()))) {
+			cout << file.string() << ": FAILED, can not decode" << endl;
+			v.failed++;
+			continue;
+		}
+		VerifyOperations(v, file.stem().string(), file, gray);
+	}
+	for (int g = 0; g < 4; g++) {
+		const char* name[] = { "LinearB2W", "LinearW2B", "RadialB2W", "RadialW2B" };
+		MLGray gray;
+		if (g < 2) { gray.LinearGradient(g == 0); }
+		else { gray.RadialGradient(g == 2); }
+		string input = string("Synthetic") + name[g];
+		if (("input/" + input).find(v.opt.filter) != string::npos) { v.Check("input/" + input, gray); }
+		VerifyOperations(v, input, fs::path(), gray);
+	}
+	// The generators of the synthetic inputs, at full size and as preview
+	const char* spec[] = { "@gradient:1000:600", "@radial:777:555", "@noise:4711:640:480", "@checker:16:300:200",
+		"@color:4711:640:480" };
+	for (const char* s : spec) {
+		for (int scale = 1; scale <= 4; scale += 3) {
+			string name = string("input/") + s + ((scale > 1) ? "/Preview:4" : "");
+			if (name.find(v.opt.filter) == string::npos) { continue; }
+			MLSource src(s);
+			src.SetScale(scale);
+			MLGray gray;
+			if (!gray.SaturateGIMP(src)) {
+				cout << name << ": FAILED, can not generate" << endl;
+				v.failed++;
+				continue;
+			}
+			v.Check(name, gray);
+		}
+	}
+	for (const fs::path& file : Files(v.opt.commands, ".csv")) { VerifyCommands(v, file); }
+
+	if (v.opt.update) {
+		if (!WriteGolden(v.opt.golden, v.golden)) {
+			cout << "Can not write " << v.opt.golden << endl;
+			return 1;
+		}
+		cout << v.golden.size() << " golden hashes written to " << v.opt.golden << endl;
+		if (v.failed > 0) { cout << v.failed << " cases failed" << endl; }
+		return (v.failed > 0) ? 1 : 0;
+	}
+	cout << v.exact << " exact, " << v.approximate << " approximate, " << v.failed << " failed, " << v.missing
+		<< " without golden hash" << endl;
+	return ((v.failed > 0) || (v.missing > 0)) ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include "Trace.h"
+#include <thread>
+#include <vector>
+
+/**
+<summary>A minimal parallel-for for the pixel-parallel operations. The range is split into one contiguous
+block per thread. The result of an operation must not depend on the number of threads.</summary>
+*/
+namespace Parallel {
+    /**
+    <summary>Number of threads used by For(). 0 means one thread per hardware thread.</summary>
+    */
+    inline int threads = 0;
+    /**
+    <summary>Ranges smaller than this are not split.</summary>
+    */
+    const int MinBlock = 16;
+
+    /**
+    <summary>Sets the number of threads for the parallel operations.</summary>
+    <param name="n">Number of threads. 1 runs everything in the calling thread, 0 uses all hardware threads.</param>
+    */
+    inline void SetThreads(int n) { threads = (n < 0) ? 0 : n; }
+
+    /**
+    <returns>The number of threads For() will use.</returns>
+    */
+    inline int Threads() {
+        if (threads > 0) { return threads; }
+        int n = (int)std::thread::hardware_concurrency();
+        return (n > 0) ? n : 1;
+    }
+
+    /**
+    <summary>Calls f(from,to) for disjoint blocks [from,to) which cover [begin,end). The blocks are processed in parallel.</summary>
+    */
+    template<class F>
+    void For(int begin, int end, F f) {
+        int n = end - begin;
+        int nt = Threads();
+        if (nt > n / MinBlock) { nt = n / MinBlock; }
+        if (nt <= 1) {
+            if (n > 0) { f(begin, end); }
+            return;
+        }
+        std::vector<std::thread> pool;
+        pool.reserve(nt - 1);
+        for (int t = 1; t < nt; t++) {
+            int from = begin + (int)((long long)n * t / nt);
+            int to = begin + (int)((long long)n * (t + 1) / nt);
+            pool.emplace_back([f, from, to]() mutable {
+                Trace::Scope s("Parallel::For");
+                f(from, to);
+            });
+        }
+        {
+            Trace::Scope s("Parallel::For");
+            f(begin, begin + (int)((long long)n / nt));
+        }
+        for (auto& th : pool) { th.join(); }
+    }
+}
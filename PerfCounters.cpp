@@ -0,0 +1,123 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "PerfCounters.h"
+#include <atomic>
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	std::atomic<bool> enabled{ false };
+
+#ifdef __linux__
+	const int Events = 5;
+	const uint64_t Config[Events] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES };
+
+	// The counters of a thread. They are closed when the thread ends.
+	struct ThreadCounters {
+		int fd[Events] = { -1, -1, -1, -1, -1 };
+		bool opened = false;
+		int error = 0;  // errno of the failed perf_event_open()
+
+		bool Open() {
+			if (opened) { return error == 0; }
+			opened = true;
+			for (int i = 0; i < Events; i++) {
+				perf_event_attr attr;
+				memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = Config[i];
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.inherit = 1;  // Counts the threads created after the opening, e.g. by Parallel::For()
+				attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+				if (fd[i] < 0) {
+					error = errno;
+					Close();
+					return false;
+				}
+			}
+			return true;
+		}
+		void Close() {
+			for (int i = 0; i < Events; i++) {
+				if (fd[i] >= 0) { close(fd[i]); }
+				fd[i] = -1;
+			}
+		}
+		// Back to the state before the first Open()
+		void Reset() {
+			Close();
+			opened = false;
+			error = 0;
+		}
+		~ThreadCounters() { Close(); }
+
+		// The count scaled by enabled/running time, if the PMU multiplexed the counter
+		bool Value(int i, uint64_t& value) const {
+			uint64_t v[3];
+			if (read(fd[i], v, sizeof(v)) != (ssize_t)sizeof(v)) { return false; }
+			value = ((v[2] > 0) && (v[2] < v[1])) ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+			return true;
+		}
+	};
+
+	thread_local ThreadCounters counters;
+#endif
+}
+
+namespace PerfCounters {
+	bool Enable(const char** message) {
+#ifdef __linux__
+		// Only a probe. Counters opened here would be inherited by the threads the caller starts before its first
+		// Read(), e.g. the reader of a pipeline, and count their whole lifetime a second time.
+		bool ok = counters.Open();
+		int error = counters.error;
+		counters.Reset();
+		if (ok) {
+			enabled = true;
+			return true;
+		}
+		if (message != nullptr) {
+			*message = ((error == ENOENT) || (error == EOPNOTSUPP))
+				? "the CPU has no accessible performance counters"
+				: ((error == EACCES) || (error == EPERM))
+				? "perf_event_open is not permitted, see /proc/sys/kernel/perf_event_paranoid"
+				: "perf_event_open failed";
+		}
+		return false;
+#else
+		if (message != nullptr) { *message = "performance counters are only supported on Linux"; }
+		return false;
+#endif
+	}
+
+	bool Enabled() {
+		return enabled;
+	}
+
+	Sample Read() {
+		Sample s;
+#ifdef __linux__
+		if (!enabled || !counters.Open()) { return s; }
+		uint64_t* value[Events] = { &s.cycles, &s.instructions, &s.llcMisses, &s.branches, &s.branchMisses };
+		for (int i = 0; i < Events; i++) {
+			if (!counters.Value(i, *value[i])) { return Sample(); }
+		}
+		s.valid = true;
+#endif
+		return s;
+	}
+}
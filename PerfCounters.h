@@ -0,0 +1,84 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+
+/**
+<summary>
+    The hardware performance counters of the CPU: cycles, instructions, last level cache misses, branches and
+    branch misses. They show where an operation loses its time, e.g. a low IPC with many cache misses for the
+    column passes or a high branch miss rate for the border code of the diffusers.
+    The counters are read with perf_event_open() and count in user mode only, so they work with the default
+    perf_event_paranoid setting. They are counted per thread; the threads created by a thread after its first Read(),
+    e.g. the workers of Parallel::For(), are added when they finish. So the difference of two Read() calls is the
+    work of an operation including its parallel parts.
+    Start long-lived threads, e.g. the reader and writer of a pipeline, before the first Read() of their creator.
+    Otherwise their whole work is added to the creator when they finish, in addition to their own counts.
+    Only available on Linux on a CPU whose PMU is accessible (not in most virtual machines). Otherwise Enable()
+    fails and nothing is counted.
+</summary>
+*/
+namespace PerfCounters {
+    /**
+    <summary>The counts of a thread. If the counters are multiplexed, the counts are scaled to the full time.</summary>
+    */
+    struct Sample {
+        bool valid = false;
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t llcMisses = 0;
+        uint64_t branches = 0;
+        uint64_t branchMisses = 0;
+
+        Sample operator-(const Sample& s) const {
+            Sample d;
+            d.valid = valid && s.valid;
+            d.cycles = cycles - s.cycles;
+            d.instructions = instructions - s.instructions;
+            d.llcMisses = llcMisses - s.llcMisses;
+            d.branches = branches - s.branches;
+            d.branchMisses = branchMisses - s.branchMisses;
+            return d;
+        }
+        Sample& operator+=(const Sample& s) {
+            valid = valid && s.valid;
+            cycles += s.cycles;
+            instructions += s.instructions;
+            llcMisses += s.llcMisses;
+            branches += s.branches;
+            branchMisses += s.branchMisses;
+            return *this;
+        }
+        /**
+        <returns>Instructions per cycle.</returns>
+        */
+        double Ipc() const { return (cycles > 0) ? (double)instructions / cycles : 0.0; }
+        /**
+        <returns>The fraction of the branches which were mispredicted.</returns>
+        */
+        double BranchMissRate() const { return (branches > 0) ? (double)branchMisses / branches : 0.0; }
+    };
+
+    /**
+    <summary>Switches the counting on. The counters of a thread are opened by its first Read(), also for the calling
+    thread.</summary>
+    <returns>false if the counters are not supported. The message tells why.</returns>
+    */
+    bool Enable(const char** message = nullptr);
+    /**
+    <returns>true after a successful Enable().</returns>
+    */
+    bool Enabled();
+    /**
+    <returns>The counts of the calling thread so far. Not valid if counting is off or the counters of the thread
+    could not be opened.</returns>
+    */
+    Sample Read();
+}
@@ -0,0 +1,49 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+* A counter based random generator. The random number of a pixel is a hash of its coordinates and the seed.
+* Each pixel can be evaluated independently. The result does not depend on the scan order or the number of threads.
+* The hash uses only 32-bit operations, so the loops over a line can be vectorized.
+*
+***********************************************************************/
+#pragma once
+#include <cstdint>
+
+/**
+<summary>The "lowbias32" integer hash of C. Wellons. A bijective mixer with very low bias.</summary>
+*/
+inline uint32_t Hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+/**
+<summary>The key of a line for PixelRandom(). Calculate it once per line.</summary>
+*/
+inline uint32_t LineKey(uint32_t seed, int y) {
+    return Hash32((uint32_t)y ^ Hash32(seed ^ 0x9e3779b9U));
+}
+
+/**
+<summary>The random number of pixel x in the line with the key lineKey.</summary>
+<returns>an uniform distributed 32-bit random number</returns>
+*/
+inline uint32_t PixelRandom(uint32_t lineKey, int x) {
+    return Hash32(lineKey ^ Hash32((uint32_t)x));
+}
+
+/**
+<summary>Maps a 32-bit random number to an uniform distributed integer in [lo,hi] without modulo.</summary>
+*/
+inline int32_t UniformInt(uint32_t r, int32_t lo, int32_t hi) {
+    return lo + (int32_t)(((uint64_t)r * (uint64_t)(uint32_t)(hi - lo + 1)) >> 32);
+}
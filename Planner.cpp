@@ -0,0 +1,63 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Planner.h"
+using namespace std;
+
+void Planner::Add(int lineNr, const vector<string>& keys) {
+	if (depth < 0) { depth = (int)keys.size(); }
+	Node* n = &root;
+	for (int level = 0; level < depth; level++) {
+		const string& key = (level < (int)keys.size()) ? keys[level] : string();
+		Node* c = nullptr;
+		for (auto& p : n->next) {
+			if (p->key == key) {
+				c = p.get();
+				break;
+			}
+		}
+		if (c == nullptr) {
+			n->next.push_back(make_unique<Node>());
+			c = n->next.back().get();
+			c->key = key;
+			c->lineNr = lineNr;
+			stages++;
+		}
+		n = c;
+	}
+	n->finish.push_back(lineNr);
+	lines++;
+}
+
+vector<int> Planner::FirstStages() const {
+	vector<int> first;
+	for (auto& c : root.next) { first.push_back(c->lineNr); }
+	return first;
+}
+
+void Planner::Run(Action action) {
+	MLGray img;
+	Run(root, 0, img, action);
+	root = Node();
+	depth = -1;
+	lines = 0;
+	stages = 0;
+}
+
+void Planner::Run(Node& n, int level, MLGray& img, Action& action) {
+	for (size_t i = 0; i < n.finish.size(); i++) {
+		action(depth, n.finish[i], img, i + 1 == n.finish.size());
+	}
+	for (size_t i = 0; i < n.next.size(); i++) {
+		Node& c = *n.next[i];
+		// The last successor takes over the image, the others work on a copy. At level 0 there is no image yet.
+		MLGray work = ((level > 0) && (i + 1 < n.next.size())) ? img.Clone() : move(img);
+		if (action(level, c.lineNr, work, false)) {
+			Run(c, level + 1, work, action);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include "MLGray.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+<summary>
+    Plans the execution of a command file. Each line is a chain of stages, e.g. (input and converter),
+    (preprocessing), (halftoning), (postprocessing). Lines which start with the same stages share them: the planner
+    merges the lines into a tree, so every distinct prefix is computed exactly once.
+    The tree is executed depth first. The image of a stage is copied for all but the last of its successors,
+    which takes it over. So at most one intermediate image per stage level is kept in memory, independent of the
+    number of lines.
+    The lines are finished in tree order: lines with a common prefix are finished together, otherwise in the
+    order of the command file.
+</summary>
+*/
+class Planner {
+public:
+    /**
+    <summary>Performs a stage of a line on the image. Returns false if the stage failed, then the successors
+    of the stage are skipped.</summary>
+    <param name="level">The stage level. The number of stages of a line is the final step, it is called for
+    every line and must not change the image.</param>
+    <param name="lineNr">The first line which contains the stage.</param>
+    <param name="img">The result of the previous stage. At level 0 the image is empty.</param>
+    <param name="last">In the final step: true for the last line which ends with img. The action may then take
+    over img, e.g. move it instead of copying it. Otherwise false.</param>
+    */
+    typedef std::function<bool(int level, int lineNr, MLGray& img, bool last)> Action;
+
+    /**
+    <summary>Adds a line to the plan.</summary>
+    <param name="lineNr">The line number. It is passed to the Action.</param>
+    <param name="stages">The keys of the stages. Two lines share a stage, if all keys up to this stage are equal.
+    All lines must have the same number of stages.</param>
+    */
+    void Add(int lineNr, const std::vector<std::string>& stages);
+    /**
+    <summary>Executes the plan. The plan is empty afterwards.</summary>
+    */
+    void Run(Action action);
+    /**
+    <returns>The lines of the first stages in the order in which Run() executes them. E.g. to read ahead the inputs.
+    </returns>
+    */
+    std::vector<int> FirstStages() const;
+    /**
+    <returns>The number of lines in the plan.</returns>
+    */
+    int Lines() { return lines; }
+    /**
+    <returns>The number of stages which will be executed. Without sharing this is lines*stages.</returns>
+    */
+    int Stages() { return stages; }
+
+private:
+    struct Node {
+        std::string key;
+        int lineNr = 0;  // first line which contains the stage
+        std::vector<std::unique_ptr<Node>> next;
+        std::vector<int> finish;  // the lines which end here
+    };
+
+    void Run(Node& n, int level, MLGray& img, Action& action);
+
+    Node root;
+    int depth = -1;
+    int lines = 0;
+    int stages = 0;
+};
@@ -0,0 +1,122 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "ResultCache.h"
+#include "MLGray.h"
+#include "Synthetic.h"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <system_error>
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+	const uint64_t FnvBasis = 14695981039346656037ull;
+	const uint64_t FnvPrime = 1099511628211ull;
+
+	inline uint64_t Fnv(uint64_t h, const char* p, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			h ^= (unsigned char)p[i];
+			h *= FnvPrime;
+		}
+		return h;
+	}
+
+	struct FileHash {
+		uintmax_t size;
+		fs::file_time_type time;
+		uint64_t hash;
+	};
+
+	mutex lock;
+	map<string, FileHash> inputs;  // Hashes of the input images read so far
+
+	bool HashFile(const string& fileName, uint64_t& hash) {
+		error_code ec;
+		uintmax_t size = fs::file_size(fileName, ec);
+		if (ec) { return false; }
+		fs::file_time_type time = fs::last_write_time(fileName, ec);
+		if (ec) { return false; }
+		{
+			lock_guard<mutex> guard(lock);
+			auto it = inputs.find(fileName);
+			if ((it != inputs.end()) && (it->second.size == size) && (it->second.time == time)) {
+				hash = it->second.hash;
+				return true;
+			}
+		}
+		ifstream f(fileName, ios::binary);
+		if (!f) { return false; }
+		uint64_t h = FnvBasis;
+		char chunk[1 << 16];
+		while (f) {
+			f.read(chunk, sizeof(chunk));
+			h = Fnv(h, chunk, (size_t)f.gcount());
+		}
+		lock_guard<mutex> guard(lock);
+		inputs[fileName] = { size, time, h };
+		hash = h;
+		return true;
+	}
+
+	string KeyFile(const string& outputFile) {
+		fs::path p(outputFile);
+		return (p.parent_path() / ".cache" / p.filename()).string() + ".key";
+	}
+}
+
+namespace ResultCache {
+	string Key(const string& inputFile, const string& pipeline) {
+		uint64_t h = FnvBasis;
+		if (Synthetic::IsSpec(inputFile)) { h = Fnv(h, inputFile.data(), inputFile.size()); }
+		else if (!HashFile(inputFile, h)) { return ""; }
+		int version = MLGray::VERSION;
+		h = Fnv(h, (const char*)&version, sizeof(version));
+		h = Fnv(h, pipeline.data(), pipeline.size());
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+		return hex;
+	}
+
+	bool Hit(const string& outputFile, const string& key) {
+		if (key.empty()) { return false; }
+		error_code ec;
+		if (!fs::exists(outputFile, ec)) { return false; }
+		ifstream f(KeyFile(outputFile));
+		string stored;
+		return (bool)getline(f, stored) && (stored == key);
+	}
+
+	void Invalidate(const string& outputFile) {
+		error_code ec;
+		fs::remove(KeyFile(outputFile), ec);
+	}
+
+	void Store(const string& outputFile, const string& key) {
+		if (key.empty()) { return; }
+		string keyFile = KeyFile(outputFile);
+		string tmpFile = keyFile + ".tmp";
+		error_code ec;
+		fs::create_directories(fs::path(keyFile).parent_path(), ec);
+		{
+			ofstream f(tmpFile, ios::trunc);
+			f << key << "\n";
+			if (!f.flush()) {
+				f.close();
+				fs::remove(tmpFile, ec);
+				return;
+			}
+		}
+		// A reader sees the old or the new key, never a partial one
+		fs::rename(tmpFile, keyFile, ec);
+		if (ec) { fs::remove(tmpFile, ec); }
+	}
+}
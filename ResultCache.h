@@ -0,0 +1,46 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <string>
+
+/**
+<summary>
+    A content-addressed cache of the output images of the command file. The key of a line is a hash of the
+    contents of the input image, the normalized pipeline (converter, preprocessing, halftoning, postprocessing and
+    region with all parameters) and MLGray::VERSION. The key of an output is stored in a small file in the
+    subdirectory .cache of the output directory. A line whose key matches the stored key of an existing output is
+    not computed again.
+    The functions are thread-safe.
+</summary>
+*/
+namespace ResultCache {
+    /**
+    <summary>The key of a command line.</summary>
+    <param name="inputFile">The input image. The hash of its contents is kept as long as its size and time stamp
+    do not change. For a synthetic image (see Synthetic) the spec is hashed.</param>
+    <param name="pipeline">The normalized pipeline. See Command::Key().</param>
+    <returns>The key as hex string. Empty if the input can not be read.</returns>
+    */
+    std::string Key(const std::string& inputFile, const std::string& pipeline);
+    /**
+    <returns>true if outputFile exists and was written with key.</returns>
+    */
+    bool Hit(const std::string& outputFile, const std::string& key);
+    /**
+    <summary>Removes the key of outputFile. Call it before outputFile is written, so an interrupted or failed write
+    does not leave a stale key.</summary>
+    */
+    void Invalidate(const std::string& outputFile);
+    /**
+    <summary>Records that outputFile was written with key. Call it only after outputFile was written successfully.
+    The key file is written to a temporary file and renamed.</summary>
+    */
+    void Store(const std::string& outputFile, const std::string& key);
+}
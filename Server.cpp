@@ -0,0 +1,175 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Server.h"
+#include "Trace.h"
+#include <iostream>
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+/**
+<summary>A client stream. fd < 0 is stdin/stdout. The socket is closed when the last job of the client is done.</summary>
+*/
+struct Server::Connection {
+	int fd;
+	mutex lock;
+	string buffer;
+
+	Connection(int f) : fd(f) {}
+	~Connection() {
+#ifndef _WIN32
+		if (fd >= 0) { close(fd); }
+#endif
+	}
+
+	bool ReadLine(string& line) {
+		if (fd < 0) { return (bool)getline(cin, line); }
+#ifndef _WIN32
+		char chunk[4096];
+		size_t p;
+		while ((p = buffer.find('\n')) == string::npos) {
+			ssize_t n = read(fd, chunk, sizeof(chunk));
+			if (n <= 0) {
+				line.swap(buffer);
+				buffer.clear();
+				return !line.empty();
+			}
+			buffer.append(chunk, (size_t)n);
+		}
+		line = buffer.substr(0, p);
+		buffer.erase(0, p + 1);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void Write(const string& record) {
+		lock_guard<mutex> guard(lock);
+		if (fd < 0) {
+			cout << record << flush;
+			return;
+		}
+#ifndef _WIN32
+		// A client which closed the connection early loses its records
+		for (size_t done = 0; done < record.size();) {
+			ssize_t n = write(fd, record.data() + done, record.size() - done);
+			if (n <= 0) { return; }
+			done += (size_t)n;
+		}
+#endif
+	}
+};
+
+Server::Server(int n, Handler h) : handler(h) {
+	n = (n < 1) ? 1 : n;
+	maxQueue = 4 * (size_t)n;
+	workers.reserve(n);
+	for (int w = 0; w < n; w++) {
+		workers.emplace_back(&Server::Work, this, w);
+	}
+}
+
+Server::~Server() {
+	Drain();
+	{
+		lock_guard<mutex> guard(lock);
+		stop = true;
+	}
+	hasJob.notify_all();
+	for (auto& t : workers) { t.join(); }
+}
+
+void Server::Submit(Job job) {
+	unique_lock<mutex> guard(lock);
+	hasRoom.wait(guard, [this] { return queue.size() < maxQueue; });
+	queue.push_back(move(job));
+	guard.unlock();
+	hasJob.notify_one();
+}
+
+void Server::Drain() {
+	unique_lock<mutex> guard(lock);
+	hasRoom.wait(guard, [this] { return queue.empty() && (active == 0); });
+}
+
+void Server::Work(int worker) {
+	Trace::ThreadName("Worker " + to_string(worker));
+	for (;;) {
+		unique_lock<mutex> guard(lock);
+		hasJob.wait(guard, [this] { return stop || !queue.empty(); });
+		if (queue.empty()) { return; }
+		Job job = move(queue.front());
+		queue.pop_front();
+		active++;
+		guard.unlock();
+		hasRoom.notify_all();
+
+		string record = to_string(job.lineNr) + "," + handler(worker, job.lineNr, job.line) + "\n";
+		job.out->Write(record);
+		job.out.reset();  // closes the connection after its last record
+
+		guard.lock();
+		active--;
+		guard.unlock();
+		hasRoom.notify_all();
+	}
+}
+
+void Server::Serve(shared_ptr<Connection> c) {
+	string line;
+	for (int lineNr = 1; c->ReadLine(line); lineNr++) {
+		if ((!line.empty()) && (line.back() == '\r')) { line.pop_back(); }
+		if (line.empty()) { continue; }
+		if (line[0] == '#') { continue; } // Comment Line
+		Submit({ lineNr, line, c });
+	}
+}
+
+int Server::RunStdin() {
+	Serve(make_shared<Connection>(-1));
+	Drain();
+	return 0;
+}
+
+int Server::RunSocket(const string& path) {
+#ifdef _WIN32
+	cout << "Server: Unix-domain sockets are not supported on this platform" << endl;
+	return 1;
+#else
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || (path.size() >= sizeof(addr.sun_path))) {
+		cout << "Server: Invalid socket path " << path << endl;
+		return 1;
+	}
+	path.copy(addr.sun_path, path.size());
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0) {
+		cout << "Server: Can not create socket" << endl;
+		return 1;
+	}
+	unlink(path.c_str());
+	if ((bind(s, (sockaddr*)&addr, sizeof(addr)) < 0) || (listen(s, 16) < 0)) {
+		cout << "Server: Can not listen on " << path << endl;
+		close(s);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	cout << "Server: Listening on " << path << " with " << workers.size() << " workers" << endl;
+	for (;;) {
+		int fd = accept(s, nullptr, nullptr);
+		if (fd < 0) { continue; }
+		thread(&Server::Serve, this, make_shared<Connection>(fd)).detach();
+	}
+#endif
+}
@@ -0,0 +1,97 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+<summary>
+    The daemon mode of MonaLena. Reads command lines in the format of the *.csv command file from stdin or from a
+    local Unix-domain socket and processes them on a pool of worker threads which live as long as the server.
+    The images, the Arena buffers and the static tables stay warm between the jobs.
+    For every command line a completion record is written back as soon as the job is done. The records are in
+    completion order, not in submission order. Each record starts with the line number of the command in its stream.
+</summary>
+*/
+class Server {
+public:
+    /**
+    <summary>Processes one command line. Called concurrently by the worker threads.</summary>
+    <param name="worker">The number of the calling worker, 0..workers-1.</param>
+    <param name="lineNr">The line number of the command in its stream.</param>
+    <param name="line">The command line.</param>
+    <returns>The completion record without the line number and without the line end.</returns>
+    */
+    typedef std::function<std::string(int worker, int lineNr, const std::string& line)> Handler;
+
+    /**
+    <param name="workers">The number of worker threads. Values below 1 are set to 1.</param>
+    <param name="handler">Processes the command lines.</param>
+    */
+    Server(int workers, Handler handler);
+    /**
+    <summary>Finishes the queued jobs and stops the workers.</summary>
+    */
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    /**
+    <summary>Reads command lines from stdin until end of file. The records are written to stdout.</summary>
+    <returns>0 after all jobs are done.</returns>
+    */
+    int RunStdin();
+    /**
+    <summary>Listens on the Unix-domain socket path. Every client connection is a stream of command lines, the
+    records are written back to the same connection. Runs until the process is terminated.
+    Not available on Windows.</summary>
+    <returns>1 if the socket can not be created.</returns>
+    */
+    int RunSocket(const std::string& path);
+
+private:
+    struct Connection;
+    struct Job {
+        int lineNr;
+        std::string line;
+        std::shared_ptr<Connection> out;
+    };
+
+    /**
+    <summary>Queues a job. Blocks while the queue is full, which throttles a client that submits faster than
+    the workers can process.</summary>
+    */
+    void Submit(Job job);
+    /**
+    <summary>Waits until the queue is empty and all workers are idle.</summary>
+    */
+    void Drain();
+    /**
+    <summary>Reads the command lines of a stream and submits them. Comment and empty lines are skipped.</summary>
+    */
+    void Serve(std::shared_ptr<Connection> c);
+    void Work(int worker);
+
+    Handler handler;
+    std::vector<std::thread> workers;
+    std::deque<Job> queue;
+    std::mutex lock;
+    std::condition_variable hasJob;   // signalled when a job is queued or the server stops
+    std::condition_variable hasRoom;  // signalled when a job is taken from the queue or finished
+    size_t maxQueue;
+    int active = 0;
+    bool stop = false;
+};
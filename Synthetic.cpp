@@ -0,0 +1,118 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Synthetic.h"
+#include "Parallel.h"
+#include "PixelRandom.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+using namespace std;
+
+namespace {
+	enum Pattern { GRADIENT, RADIAL, NOISE, CHECKER, COLOR };
+
+	struct Spec {
+		int pattern = GRADIENT;
+		int width = 512;
+		int height = 512;
+		uint32_t seed = 0;
+		int size = 64;  // The squares of the checker board
+	};
+
+	// Parses @name[:p1[:p2...]]. The names and the number of parameters are checked, the values are not.
+	bool Parse(const string& text, Spec& spec) {
+		istringstream s(text.substr(1));
+		string name;
+		getline(s, name, ':');
+		vector<long long> p;
+		string v;
+		while (getline(s, v, ':')) {
+			char* end = nullptr;
+			p.push_back(strtoll(v.c_str(), &end, 10));
+			if ((end == v.c_str()) || (*end != 0)) { return false; }
+		}
+		size_t first = 0;  // The index of the width
+		if (name == "gradient") { spec.pattern = GRADIENT; }
+		else if (name == "radial") { spec.pattern = RADIAL; }
+		else if (name == "noise") { spec.pattern = NOISE; first = 1; }
+		else if (name == "checker") { spec.pattern = CHECKER; first = 1; }
+		else if (name == "color") { spec.pattern = COLOR; first = 1; }
+		else { return false; }
+		if (p.size() > first + 2) { return false; }
+		if ((first == 1) && (p.size() > 0)) {
+			if (spec.pattern != CHECKER) { spec.seed = (uint32_t)p[0]; }
+			else { spec.size = (int)min(max(p[0], 1LL), 1LL << 30); }
+		}
+		if (p.size() > first) { spec.width = (int)min(max(p[first], 0LL), 1LL << 30); }
+		if (p.size() > first + 1) { spec.height = (int)min(max(p[first + 1], 0LL), 1LL << 30); }
+		return (spec.width > 0) && (spec.height > 0) && ((long long)spec.width * spec.height <= (1LL << 30));
+	}
+}
+
+namespace Synthetic {
+	bool Valid(const string& text) {
+		Spec spec;
+		return IsSpec(text) && Parse(text, spec);
+	}
+
+	unsigned char* Generate(const string& text, int scale, int& width, int& height, int& channels) {
+		Spec spec;
+		if (!IsSpec(text) || !Parse(text, spec)) { return nullptr; }
+		if ((scale != 2) && (scale != 4) && (scale != 8)) { scale = 1; }
+		int w = (spec.width + scale - 1) / scale;
+		int h = (spec.height + scale - 1) / scale;
+		const int c = (spec.pattern == COLOR) ? 3 : 1;
+		unsigned char* d = (unsigned char*)malloc((size_t)w * h * c);
+		if (d == nullptr) { return nullptr; }
+		const double xm = (spec.width - 1) / 2.0;
+		const double ym = (spec.height - 1) / 2.0;
+		const double radial = 512.0 / max(spec.width, spec.height);  // 512x512 is the size of MLGray::RadialGradient()
+		Parallel::For(0, h, [&](int from, int to) {
+			for (int y = from; y < to; y++) {
+				unsigned char* p = d + (size_t)y * w * c;
+				int fy = y * scale;  // The coordinates in the full size image
+				uint32_t key = LineKey(spec.seed, fy);
+				for (int x = 0; x < w; x++) {
+					int fx = x * scale;
+					if (spec.pattern == COLOR) {  // Red grows to the right, green downwards, with noise in all channels
+						int noise = UniformInt(PixelRandom(key, fx), -16, 16);
+						int r = (int)((long long)fx * 255 / spec.width) + noise;
+						int g = (int)((long long)fy * 255 / spec.height) + noise;
+						int b = 255 - (r + g) / 2;
+						p[3 * x] = (unsigned char)min(max(r, 0), 255);
+						p[3 * x + 1] = (unsigned char)min(max(g, 0), 255);
+						p[3 * x + 2] = (unsigned char)min(max(b, 0), 255);
+						continue;
+					}
+					int v = 0;
+					switch (spec.pattern) {
+					case GRADIENT:
+						v = (int)((long long)fx * 256 / spec.width);
+						break;
+					case RADIAL:
+						v = (int)(sqrt((fx - xm) * (fx - xm) + (fy - ym) * (fy - ym)) * radial + 0.5);
+						break;
+					case NOISE:
+						v = UniformInt(PixelRandom(key, fx), 0, 255);
+						break;
+					default:
+						v = (((fx / spec.size) + (fy / spec.size)) & 1) ? 255 : 0;
+					}
+					p[x] = (unsigned char)min(max(v, 0), 255);
+				}
+			}
+		});
+		width = w;
+		height = h;
+		channels = c;
+		return d;
+	}
+}
@@ -0,0 +1,50 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <string>
+
+/**
+<summary>
+    Synthetic input images of any size, computed in memory without file I/O. A synthetic image is named by a spec
+    which starts with @ and is used instead of a file name, e.g. in the input column of the command file:
+    @gradient:w:h      a linear gradient from black on the left to white on the right
+    @radial:w:h        a radial gradient from black in the middle to white in the corners
+    @noise:seed:w:h    uniform noise, the same for the same seed
+    @checker:size:w:h  a checker board of squares with size pixels
+    @color:seed:w:h    a RGB image: red and green gradients with noise, e.g. for the color conversions
+    The parameters can be omitted from the right, the defaults are 512x512 pixels, seed 0 and size 64.
+    The images are deterministic: a pixel depends only on its coordinates and the parameters. So they do not depend
+    on the number of threads and a preview shows the same pattern as the full size image.
+</summary>
+*/
+namespace Synthetic {
+    /**
+    <returns>true if name is a spec, i.e. it starts with @.</returns>
+    */
+    inline bool IsSpec(const std::string& name) { return !name.empty() && (name[0] == '@'); }
+    /**
+    <returns>true if the spec names a known pattern with valid parameters. Nothing is generated.</returns>
+    */
+    bool Valid(const std::string& spec);
+
+    /**
+    <summary>Generates the image of a spec. The lines are computed in parallel.</summary>
+    <param name="spec">The spec, e.g. @noise:4711:16384:16384.</param>
+    <param name="scale">1, 2, 4 or 8. The image is sampled at every scale-th pixel, the size is divided by scale and
+    rounded up.</param>
+    <param name="width">Receives the width of the image.</param>
+    <param name="height">Receives the height of the image.</param>
+    <param name="channels">Receives 3 for @color (RGB) and 1 for the other patterns (gray).</param>
+    <returns>The pixels with 8 bit per channel, line by line without padding. The buffer is allocated with malloc(),
+    free it with stbi_image_free() or free(). nullptr if the spec is invalid or the image is larger than 2^30 pixels.
+    </returns>
+    */
+    unsigned char* Generate(const std::string& spec, int scale, int& width, int& height, int& channels);
+}
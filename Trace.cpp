@@ -0,0 +1,166 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+*
+* This file is part of CMonaLisa
+*
+***********************************************************************/
+#include "Trace.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+namespace {
+	struct Event {
+		const char* name;
+		int64_t begin;
+		int64_t end;
+		int tid;
+		char detail[48];
+	};
+
+	struct Ring {
+		vector<Event> events;
+		size_t next = 0;  // The number of recorded events, events[next % size] is written next
+	};
+
+	struct Registry {
+		mutex lock;
+		vector<unique_ptr<Ring>> rings;
+		vector<Ring*> free;  // The rings of finished threads
+		map<int, string> names;
+		size_t capacity = 65536;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		atomic<int> tids{ 0 };
+	};
+
+	Registry& GetRegistry() {
+		static Registry r;
+		return r;
+	}
+
+	// The ring of a thread. It goes back to the registry when the thread ends.
+	struct ThreadRing {
+		Ring* ring = nullptr;
+		int tid = GetRegistry().tids.fetch_add(1) + 1;
+		~ThreadRing() {
+			if (ring == nullptr) { return; }
+			Registry& r = GetRegistry();
+			lock_guard<mutex> guard(r.lock);
+			r.free.push_back(ring);
+		}
+	};
+
+	thread_local ThreadRing threadRing;
+
+	Ring* Acquire() {
+		Registry& r = GetRegistry();
+		lock_guard<mutex> guard(r.lock);
+		if (!r.free.empty()) {
+			Ring* ring = r.free.back();
+			r.free.pop_back();
+			return ring;
+		}
+		r.rings.emplace_back(new Ring());
+		r.rings.back()->events.resize(r.capacity);
+		return r.rings.back().get();
+	}
+
+	void Escaped(ostream& o, const char* s) {
+		for (; *s != 0; s++) {
+			if ((*s == '"') || (*s == '\\')) { o << '\\'; }
+			if ((unsigned char)*s >= 0x20) { o << *s; }
+		}
+	}
+}
+
+namespace Trace {
+	atomic<bool> enabled{ false };
+
+	void Start(size_t eventsPerThread) {
+		Registry& r = GetRegistry();
+		{
+			lock_guard<mutex> guard(r.lock);
+			r.capacity = (eventsPerThread > 0) ? eventsPerThread : 1;
+			for (auto& ring : r.rings) {
+				ring->events.assign(r.capacity, Event());
+				ring->next = 0;
+			}
+			r.start = chrono::steady_clock::now();
+		}
+		enabled = true;
+	}
+
+	int64_t Now() {
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - GetRegistry().start).count();
+	}
+
+	void ThreadName(const string& name) {
+		Registry& r = GetRegistry();
+		lock_guard<mutex> guard(r.lock);
+		r.names[threadRing.tid] = name;
+	}
+
+	void Record(const char* name, const char* detail, int64_t begin, int64_t end) {
+		if (threadRing.ring == nullptr) { threadRing.ring = Acquire(); }
+		Ring& ring = *threadRing.ring;
+		Event& e = ring.events[ring.next % ring.events.size()];
+		e.name = name;
+		e.begin = begin;
+		e.end = end;
+		e.tid = threadRing.tid;
+		size_t n = strlen(detail);
+		if (n >= sizeof(e.detail)) { n = sizeof(e.detail) - 1; }
+		memcpy(e.detail, detail, n);
+		e.detail[n] = 0;
+		ring.next++;
+	}
+
+	bool Write(const string& fileName) {
+		enabled = false;
+		Registry& r = GetRegistry();
+		lock_guard<mutex> guard(r.lock);
+		ofstream o(fileName);
+		if (!o) { return false; }
+		o << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+		bool first = true;
+		auto separator = [&o, &first]() {
+			if (!first) { o << "," << endl; }
+			first = false;
+		};
+		for (const auto& n : r.names) {
+			separator();
+			o << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << n.first << ", \"args\": {\"name\": \"";
+			Escaped(o, n.second.c_str());
+			o << "\"}}";
+		}
+		o.setf(ios::fixed);
+		o.precision(3);
+		for (const auto& ring : r.rings) {
+			size_t size = ring->events.size();
+			size_t from = (ring->next > size) ? ring->next - size : 0;
+			for (size_t i = from; i < ring->next; i++) {
+				const Event& e = ring->events[i % size];
+				separator();
+				// A complete event: the begin and the duration in microseconds
+				o << "{\"name\": \"";
+				Escaped(o, e.name);
+				o << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.tid << ", \"ts\": " << e.begin / 1000.0
+					<< ", \"dur\": " << (e.end - e.begin) / 1000.0;
+				if (e.detail[0] != 0) {
+					o << ", \"args\": {\"detail\": \"";
+					Escaped(o, e.detail);
+					o << "\"}";
+				}
+				o << "}";
+			}
+		}
+		o << endl << "]}" << endl;
+		return (bool)o;
+	}
+}
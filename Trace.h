@@ -0,0 +1,82 @@
+/***********************************************************************
+*
+* Copyright (c) 2020 Dr. Chrilly Donninger
+* The code can be freely used for private and educational projects.
+* Commerical users must ask the author for permission at c.donninger@wavenet.at
+*
+* This file is part of MonaLisa
+*
+***********************************************************************/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+<summary>
+    A lightweight tracer for the timeline of the threads. A Scope records its begin and end as one event into a ring
+    buffer of the calling thread. The thread writes only to its own buffer, so recording takes no lock. When a buffer
+    is full, the oldest events are overwritten. The buffers of finished threads are reused by new threads, e.g. the
+    short lived threads of Parallel::For().
+    Write() stores the events in the Chrome trace format (JSON), which can be opened with chrome://tracing or
+    https://ui.perfetto.dev. Without Start() a Scope only tests a flag.
+</summary>
+*/
+namespace Trace {
+    /**
+    <summary>true between Start() and Write().</summary>
+    */
+    extern std::atomic<bool> enabled;
+
+    inline bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    /**
+    <summary>Starts recording.</summary>
+    <param name="eventsPerThread">The size of the ring buffer of a thread.</param>
+    */
+    void Start(size_t eventsPerThread = 65536);
+    /**
+    <summary>Stops recording and writes the events as Chrome trace JSON. Call it when the traced threads are done.
+    </summary>
+    <returns>false if the file can not be written.</returns>
+    */
+    bool Write(const std::string& fileName);
+    /**
+    <summary>Names the calling thread in the trace, e.g. "Reader".</summary>
+    */
+    void ThreadName(const std::string& name);
+    /**
+    <returns>The time since Start() in ns.</returns>
+    */
+    int64_t Now();
+    /**
+    <summary>Records an event of the calling thread.</summary>
+    <param name="name">The name of the event. It must be a literal or otherwise live until Write().</param>
+    <param name="detail">E.g. the parameters of the operation. Truncated to 47 characters.</param>
+    */
+    void Record(const char* name, const char* detail, int64_t begin, int64_t end);
+
+    /**
+    <summary>Records the time from the construction to the destruction as event.</summary>
+    */
+    class Scope {
+    public:
+        explicit Scope(const char* name) : name(name), begin(Enabled() ? Now() : -1) {}
+        ~Scope() {
+            if (begin >= 0) { Record(name, detail.c_str(), begin, Now()); }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        /**
+        <summary>Sets the detail of the event. Test Enabled() before building an expensive text.</summary>
+        */
+        void Detail(const std::string& d) { detail = d; }
+
+    private:
+        const char* name;
+        int64_t begin;  // negative if not recording
+        std::string detail;
+    };
+}